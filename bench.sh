@@ -0,0 +1,120 @@
+#!/bin/sh
+# Benchmark swiper against synthetic clips made by ffmpeg's lavfi sources.
+# Each result is appended to $OUT as one JSON object per line, tagged with the
+# commit and time of the run, so that runs can be compared over time.
+#
+# Saves go to library entries named bench-*, which are removed afterwards.
+# -c is only measured when run as root, and the display backends only when
+# DISPLAY is set (feh additionally needs feh installed). If Xvfb is installed,
+# the cadence -v reports is checked on a display of its own, and the script
+# exits non-zero if it's wrong.
+
+OUT=${OUT:-bench_results.jsonl}
+SIZES=${SIZES:-"320x240 1280x720 1920x1080"}
+SOURCES=${SOURCES:-"testsrc mandelbrot"}
+LENGTH=${LENGTH:-5} # ...seconds
+RATE=${RATE:-30}
+XVFB=${XVFB:-:99} # ...display for the cadence check
+
+SWIPER=./swiper
+TMP=$(mktemp -d)
+REV=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+if [ "$(id -u)" -eq 0 ]; then
+	LIB=/home/${SUDO_USER:?run with sudo, not as root}/.swiper
+	CACHE="-c"
+else
+	LIB=/home/$(id -un)/.swiper
+	CACHE=""
+fi
+
+XVFB_PID=""
+STATUS=0
+trap '[ -n "$XVFB_PID" ] && kill $XVFB_PID; rm -rf "$TMP" "$LIB"/bench-*' EXIT INT TERM
+
+now() { date +%s.%N; }
+
+# emit <clip> <stage> <json fields without braces>
+emit() {
+	printf '{"rev": "%s", "date": "%s", "clip": "%s", "stage": "%s", %s}\n' \
+		"$REV" "$DATE" "$1" "$2" "$3" | tee -a "$OUT"
+}
+
+# apply <clip> <entry> <backend> [options]; the last line swiper prints is JSON
+apply() {
+	clip=$1 entry=$2 backend=$3
+	shift 3
+	line=$($SWIPER -a -n "$entry" -f -b "$@" 2>/dev/null | tail -n 1)
+	case $line in
+		{*) fields=${line#\{}; emit "$clip" "apply-$backend" "${fields%\}}" ;;
+		*) echo "$clip: apply with $backend failed" >&2 ;;
+	esac
+}
+
+for tool in ffmpeg ffprobe; do
+	command -v $tool > /dev/null || { echo "bench: $tool not found" >&2; exit 1; }
+done
+
+for src in $SOURCES; do
+	for size in $SIZES; do
+		clip=$src-$size
+		entry=bench-$clip
+		file=$TMP/$clip.mp4
+		ffmpeg -v 0 -f lavfi -i "$src=size=$size:rate=$RATE:duration=$LENGTH" \
+			-pix_fmt yuv420p "$file" || exit 1
+
+		for fmt in jpg png; do
+			opt=""
+			[ $fmt = png ] && opt="-P"
+			start=$(now)
+			$SWIPER -s "$file" -n "$entry" -f $opt > /dev/null 2>&1 || { echo "$clip: save failed" >&2; continue; }
+			secs=$(awk "BEGIN { print $(now) - $start }")
+			frames=$(ls "$LIB/$entry" | wc -l)
+			bytes=$(du -sb "$LIB/$entry" | cut -f 1)
+			emit "$clip" save "\"format\": \"$fmt\", \"frames\": $frames, \"bytes\": $bytes, \"save_s\": $secs, \"save_fps\": $(awk "BEGIN { printf \"%.2f\", $frames / $secs }")"
+		done
+
+		[ -n "$DISPLAY" ] || continue
+		command -v feh > /dev/null && apply "$clip" "$entry" feh $CACHE
+		apply "$clip" "$entry" x $CACHE -x # decodes and writes a snapshot
+		apply "$clip" "$entry" x-snapshot -x # ...which this maps
+	done
+done
+
+# cadence <entry> <fps>; -v must report the requested fps held to a whole
+# number of refreshes, or only variable timing for an entry saved with -V
+cadence() {
+	entry=$1 fps=$2
+	line=$(DISPLAY=$XVFB $SWIPER -a -n "$entry" -f -b -x -v -p "$fps" 2>/dev/null | grep '^cadence:')
+	case $entry in
+		*-vfr) expect="cadence: variable timing" ;;
+		*) expect=$(echo "$line" | awk -v fps="$fps" '{
+				hz = $NF + 0; k = int(hz / fps + 0.5); if(k < 1) k = 1
+				printf "cadence: requested %.2ffps, achieved %.2ffps", fps, hz / k }') ;;
+	esac
+	if [ -n "$line" ] && [ "$(echo "$line" | wc -l)" -eq 1 ] && [ "${line#"$expect"}" != "$line" ]; then
+		emit "$entry" cadence "\"fps\": $fps, \"ok\": true"
+	else
+		echo "$entry: at ${fps}fps, expected '$expect...', got '$line'" >&2
+		emit "$entry" cadence "\"fps\": $fps, \"ok\": false"
+		STATUS=1
+	fi
+}
+
+if command -v Xvfb > /dev/null; then
+	file=$TMP/cadence.mp4
+	ffmpeg -v 0 -f lavfi -i "testsrc=size=160x120:rate=$RATE:duration=1" -pix_fmt yuv420p "$file" || exit 1
+	$SWIPER -s "$file" -n bench-cadence -f > /dev/null 2>&1 \
+		&& $SWIPER -s "$file" -n bench-cadence-vfr -V -f > /dev/null 2>&1 \
+		|| { echo "cadence: save failed" >&2; exit 1; }
+	Xvfb "$XVFB" -screen 0 160x120x24 -nolisten tcp > /dev/null 2>&1 &
+	XVFB_PID=$!
+	sleep 1
+	for fps in 24 25 30 50; do
+		cadence bench-cadence $fps
+	done
+	cadence bench-cadence-vfr 24
+fi
+
+exit $STATUS
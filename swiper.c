@@ -22,8 +22,11 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <dirent.h>
 #include <mntent.h>
 #include <regex.h>
@@ -32,6 +35,14 @@
 #include <math.h>
 #include <pwd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <png.h>
+#include <jpeglib.h>
 
 /* SIZES */
 #define FIELD_LEN 64
@@ -42,9 +53,13 @@
 /* DO NOT TOUCH */
 #define PROC_DIR "/proc/"
 #define PROC_ARGS "/cmdline"
+#define PSI_PATH "/proc/pressure/memory"
+#define CGROUP_PATH "/proc/self/cgroup"
+#define CGROUP_ROOT "/sys/fs/cgroup"
 #define SUDO_ENV "SUDO_USER"
-#define MATCH_STR "frame="
-#define OPTSTR "s:cPdr:fai:w:h:p:"
+#define SNMAGIC "SWIPSNP1" // bump when the layout of SNFN changes
+#define TRACE_ENV "SWIPER_TRACE"
+#define OPTSTR "s:cPdr:fai:w:h:p:n:l:t:LVxI:Q:bT:vmq:B:Mo"
 #define MNT_SZ 1000000000
 
 /* CONFIGURABLE */
@@ -52,7 +67,33 @@
 #define TFSMP "/mnt/swiper"
 #define SWIPER ".swiper"
 #define MDFN ".metadata"
+#define TMFN ".timing"
+#define PLFN ".palette"
+#define PGFN ".palette.png" // ...made by the first pass of a -Q shared save
+#define SNFN ".snapshot"
+#define BMFN ".boomerang"
 #define NUNITS 25
+#define PLHASH 4096 // power of 2, well above 256
+#define BENCH_MIN 100 // ...frames presented by -b
+#define REFRESH_HZ 60 // ...assumed for -v if xrandr can't tell
+#define JOB_FRAMES 32 // ...of raw video a save job is assumed to buffer
+#define JPEG_QUALITY 90 // ...unless set by -q
+#define PNG_LEVEL 6 // ...of compression, unless set by -q
+#define SAMPLE_FRAMES 5 // ...encoded to estimate the size of a frame, for -B
+#define FIT_MIN_QUALITY 40 // ...of jpeg, fps and width -B may go down to
+#define FIT_MIN_FPS 8
+#define FIT_MIN_WIDTH 160
+#define PSI_HIGH 10.0 // ...% of 10s some task stalled on memory, to shed frames (for -M)
+#define PSI_LOW 1.0 // ...to restore them
+#define CG_HIGH 0.90 // ...of the cgroup's memory.max in use, to shed frames
+#define CG_LOW 0.70 // ...to restore them
+#define PRESSURE_PERIOD 1 // ...seconds between looks at memory pressure
+#define SHED_HOLD 5 // ...seconds after shedding before shedding again
+#define RESTORE_HOLD 30 // ...seconds of low pressure before restoring a level
+#define SIG_SIDE 32 // ...blocks across and down a frame's signature, to find mirrored halves
+#define MIRROR_MIN 8 // ...frames a clip needs for its halves to be compared
+#define MIRROR_TOL 4 // ...luma difference of any one block still taken as the same frame
+#define PLSEP ","
 
 /* FLAGS */
 #define F_SAVE 1
@@ -66,6 +107,26 @@
 #define F_PNG 256
 #define F_PFPS 512
 #define F_INSPECT 1024
+#define F_NAME 2048
+#define F_PLAYLIST 4096
+#define F_PERIOD 8192
+#define F_LIST 16384
+#define F_VFR 32768
+#define F_XLIB 65536
+#define F_INTERP 131072
+#define F_MCI 262144
+#define F_PALETTE 524288
+#define F_PALFRAME 1048576
+#define F_BENCH 2097152
+#define F_TRACE 4194304
+#define F_VSYNC 8388608
+#define F_MONITORS 16777216
+#define F_BATCH 33554432
+#define F_LEVEL 67108864
+#define F_BUDGET 134217728
+#define F_PRESSURE 268435456
+#define F_BOOMERANG 536870912
+#define F_SHED 1073741824 // (not an option) frames reloaded by -M: no decode that won't fit, no snapshot
 
 /* Video info */
 struct metadata
@@ -74,7 +135,9 @@ struct metadata
 	int width, height; // ...in pixels
 	char *rfps, *pfps; // (render, playback)
 	char format[4];
+	int level; // ...jpeg quality or png compression (for -q), else -1
 	double duration; // ...in seconds
+	double budget; // ...in bytes, for all frames (for -B), else 0
 };
 
 /* Paths */
@@ -83,54 +146,296 @@ struct pathinfo
 	char *a_path; // ...of run frames (for -c)
 	char *s_path; // ...of saved frames
 	char *v_path; // ...of video file
+	char *l_path; // ...of wallpaper library
+	char *e_name; // ...of library entry (for -n)
+	char *t_path; // ...of trace file (for -T)
+};
+
+/* Frames of a saved wallpaper, ready to display */
+struct frameset
+{
+	char **files; // ...names, relative to a_path
+	char *a_path;
+	int n;
+	int loop; // ...steps of a loop: n, or 2n - 2 walked forward then back (for -o, or BMFN)
+	double fps; // ...render fps, or interpolated fps (for -I mci)
+	double *delays; // ...of each frame in seconds, NULL at constant fps
+	unsigned char **px; // ...decoded BGRA frames (for -x), else NULL
+	unsigned char **ix; // ...palette indices of frames saved with -Q, else NULL
+	uint32_t **lut; // ...palette of each indexed frame
+	uint32_t *shared; // ...palette of all indexed frames, for -Q shared
+	unsigned char *out[2]; // ...indexed frames expanded to BGRA
+	unsigned char *map; // ...of SNFN, which frames point into, else NULL
+	size_t mapsize;
+	int width, height; // ...of decoded frames
+	unsigned char *big; // ...frames scaled up to the display, if smaller (for -M)
+	int dwidth, dheight; // ...of the display, if frames are smaller
+	FILE *stream; // ...of frames decoded as they're shown (for -M), else NULL
+	int next; // ...frame to be read from stream
+};
+
+/* Memory pressure watch, and what it takes to reload frames at another level
+ * of memory use (for -M): 0 resident, 1 reclaimable (mapped from SNFN, and
+ * paged in from disk as shown), 2 half resolution, 3 streamed from disk */
+struct shedder
+{
+	struct metadata *md;
+	char *s_path, *a_path;
+	int flags;
+	int level, shed, restored; // (current, times shed, times restored)
+	double next, calm; // (next look at pressure, since when pressure is low)
+};
+
+/* Header of SNFN (see macros): decoded frames of a wallpaper, each starting
+ * on a page, after a table of { offset, palette offset or 0 } per frame and
+ * the palettes themselves */
+struct snapshot
+{
+	char magic[8];
+	uint64_t hash; // ...of what the frames were decoded from, and how
+	uint32_t width, height, n;
+};
+
+/* Colours of a palette and a hash table to find their index (for -Q) */
+struct palette
+{
+	uint32_t lut[256];
+	uint32_t keys[PLHASH];
+	unsigned char vals[PLHASH];
+	unsigned char used[PLHASH];
+	int n;
+};
+
+/* In-process X11 root window (for -x) */
+struct xdisplay
+{
+	Display *dpy;
+	Window root;
+	Pixmap pm;
+	GC gc;
+	XImage *img;
+	int x, y; // ...of the region drawn into (for -m), else 0
+	int width, height;
+	double refresh; // ...in Hz, for -v, else 0
+};
+
+/* Playback of a wallpaper on one monitor, by its own thread (for -m) */
+struct monitor
+{
+	pthread_t tid;
+	char name[FIELD_LEN+1]; // ...of output, as listed by xrandr
+	struct xdisplay xd; // ...sharing the display, but not the region
+	struct frameset fs;
+	double dfps;
+	int flags;
+};
+
+/* Trace of where time goes, as Chrome trace events (for -T, or TRACE_ENV) */
+struct trace
+{
+	FILE *fp; // ...NULL when not tracing
+	double t0;
+	pthread_mutex_t lock; // ...preload threads trace too
+	int n;
+};
+
+/* Progress of an ffmpeg save, for a combined display (for -s <directory>) */
+struct progress
+{
+	int frame, nfr; // (written, expected)
+	double fps, speed; // ...of encoding, speed as a multiple of real time
+	long long bytes; // ...written
+	double eta; // ...in seconds
+	pthread_mutex_t *lock; // ...held while posted to, if read by another thread, else NULL
+};
+
+/* Frames decoded by one ffmpeg, encoded by a pool of threads and written in
+ * order (for -s, without -Q). Frame i passes through slot i % nslot. */
+struct encoder
+{
+	unsigned char **raw, **enc; // ...of each slot, (rgb24 frame, encoded image)
+	size_t *len; // ...of each encoded image
+	int *frame, *state; // ...of each slot, state 0 free, 1 decoded, 2 encoding, 3 encoded
+	unsigned char *sig, *sigs; // ...of each slot, and of each frame written (see frame_signature())
+	int nslot, width, height, level, png, eof;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // ...on any change of state
+	struct progress cur, *pg; // (...so far, posted to for a batch, else NULL)
+	char *bar; // ...drawn for a save of its own, else NULL
+	double start, shown, spf; // (...of encoding, ...of bar, video seconds per frame)
+};
+
+/* Growable buffer, for encoding into memory */
+struct buffer
+{
+	unsigned char *data;
+	size_t len, cap;
+};
+
+/* A clip saved by a batch into its own library entry */
+struct job
+{
+	struct metadata md;
+	struct pathinfo pi; // ...of which only v_path, s_path are used
+	struct progress pg;
+	int state; // 0 queued, 1 saving, 2 saved, 3 skipped (for why)
+	char *why;
+	int keep; // ...frames, if folded as a boomerang (for -o), else 0
+};
+
+/* Queue of clips shared by save workers (for -s <directory>) */
+struct batch
+{
+	struct job *jobs;
+	int n, next; // (jobs, next unclaimed)
+	int threads; // ...per ffmpeg, so workers together don't oversubscribe cores
+	size_t budget, reserved; // ...of memory, in bytes
+	pthread_mutex_t lock;
+	pthread_cond_t freed;
+	int flags;
+};
+
+/* Library entries to rotate between (for -l) */
+struct playlist
+{
+	char **names;
+	int n;
+	double period; // ...in seconds, 0 rotates at loop end
+};
+
+/* Background preparation of the next playlist entry */
+struct preload
+{
+	pthread_t tid;
+	char *dst, *src; // (cache, saved) paths of entry
+	struct metadata md;
+	struct frameset fs;
+	struct xdisplay *xd;
+	int flags;
+	int state; // 0 idle, 1 loading, 2 ready
 };
 
 /* Special swiper functions */
 void swiper_show_help();
-void swiper_init_pre(struct metadata *, struct pathinfo *);
-void swiper_init_post(short int, struct metadata *, struct pathinfo *);
-short int swiper_parse_opts(int, char **, struct metadata *, struct pathinfo *);
-void swiper_safety_protocol(short int, struct metadata *, struct pathinfo *);
-void swiper_request_metadata(struct metadata *, char *);
+void swiper_init_pre(struct metadata *, struct pathinfo *, struct playlist *);
+void swiper_init_post(int, struct metadata *, struct pathinfo *);
+int swiper_parse_opts(int, char **, struct metadata *, struct pathinfo *, struct playlist *);
+void swiper_safety_protocol(int, struct metadata *, struct pathinfo *, struct playlist *);
+int swiper_request_metadata(struct metadata *, char *);
 char *swiper_resolve_mdfield(char *, char *);
+int swiper_probe_video(char *);
 void swiper_save_metadata(struct metadata *, struct pathinfo *);
-void swiper_load_metadata(struct metadata *, short int, char *);
-void swiper_print_md(struct metadata *, short int);
-void swiper_render_frames(struct metadata *, struct pathinfo *);
-void swiper_save_action(char *, int);
+void swiper_load_metadata(struct metadata *, int, char *);
+void swiper_print_md(struct metadata *, int);
+int swiper_render_frames(struct metadata *, struct pathinfo *, int, int, struct progress *);
+int swiper_fit_budget(struct metadata *, char *, int);
+double swiper_sample_frame_size(struct metadata *, char *, int);
+int swiper_save_timing(struct metadata *, struct pathinfo *);
+double *swiper_load_timing(char *, int, double);
+int swiper_save_action(char *, int, char *, struct progress *);
+void swiper_draw_progress(struct progress *, char *);
+void swiper_post_progress(struct progress *, struct progress *);
+int swiper_encode_frames(char *, struct metadata *, char *, int, int, struct progress *);
+void *swiper_encode_worker(void *);
+void swiper_write_frame(struct encoder *, int, char *, char *);
+int swiper_mirror_frames(unsigned char *, int);
+void swiper_fold_frames(char *, char *, int);
+void swiper_execute_batch(struct metadata *, struct pathinfo *, int);
+void *swiper_batch_worker(void *);
 char **swiper_retrieve_image_names(int *, char *, char *);
 void swiper_shave_s_path(char *, int, char *);
-void swiper_execute_wallpaper(char **, int, char *, double);
-void swiper_shutdown(struct metadata *, struct pathinfo *, char **, int);
+void swiper_load_frameset(struct frameset *, struct metadata *, struct xdisplay *, char *, char *, int);
+void swiper_decode_frames(struct frameset *, struct metadata *, int);
+void swiper_free_frameset(struct frameset *);
+void swiper_execute_wallpaper(struct frameset *, struct xdisplay *, double, double, struct shedder *);
+void swiper_watch_pressure(struct frameset *, struct xdisplay *, struct shedder *);
+void swiper_set_level(struct frameset *, struct xdisplay *, struct shedder *, int);
+void swiper_stream_frames(struct frameset *, struct metadata *, struct xdisplay *, char *, char *, int);
+void swiper_execute_interpolated(struct frameset *, struct xdisplay *, double, double);
+void swiper_display_frame(struct frameset *, struct xdisplay *, unsigned char *, int);
+double swiper_cadence(double, struct frameset *, struct xdisplay *, int);
+void swiper_execute_bench(struct frameset *, struct metadata *, struct xdisplay *, double, double, int);
+unsigned char *swiper_frame_pixels(struct frameset *, int, int);
+int swiper_loop_frame(struct frameset *, int);
+uint64_t swiper_snapshot_hash(char *, int, int);
+void swiper_snapshot_path(char *, char *, int, int);
+int swiper_open_snapshot(char *, int, int, struct snapshot *);
+int swiper_map_snapshot(struct frameset *, char *);
+void swiper_save_snapshot(struct frameset *, char *);
+void swiper_prune_snapshots(char *);
+void swiper_execute_playlist(struct playlist *, struct metadata *, struct pathinfo *, struct xdisplay *, int);
+void swiper_execute_monitors(struct metadata *, struct pathinfo *, struct xdisplay *, int);
+void *swiper_play_monitor(void *);
+void *swiper_preload_entry(void *);
+void swiper_parse_playlist(struct playlist *, char *);
+void swiper_list_library(char *);
+void swiper_shutdown(struct metadata *, struct pathinfo *, struct playlist *, struct frameset *, struct xdisplay *);
 
 /* Generic functions */
-void feh_display_wallpaper(char *, char *);
+void feh_display_wallpaper(char *, char *, int);
+void x_open_display(struct xdisplay *);
+void x_display_frame(struct xdisplay *, unsigned char *);
+void x_close_display(struct xdisplay *);
+double x_refresh_rate(char *);
+int x_list_monitors(struct xdisplay *, struct monitor **);
+void blend_frames(unsigned char *, unsigned char *, unsigned char *, int, size_t);
+void progress_bar(char *, double);
+void scale_frame(uint32_t *, int, int, uint32_t *, int, int);
+void frame_signature(unsigned char *, unsigned char *, int, int);
+int memory_pressure(double *, double *);
+double file_number(char *);
+size_t jpeg_encode(unsigned char **, unsigned char *, int, int, int);
+size_t png_encode(unsigned char **, unsigned char *, int, int, int);
+void png_write_buffer(png_structp, png_bytep, png_size_t);
+int palette_index(struct palette *, uint32_t *, unsigned char *, size_t);
+void palette_expand(uint32_t *, unsigned char *, uint32_t *, size_t);
+uint64_t fnv1a(uint64_t, void *, size_t);
+size_t page_align(size_t);
 int is_duplicate_proc(char *);
 char *filename(char *);
+char *shell_quote(char *);
 void cleardir(char *);
 void copydir(char *, char *);
+void warmdir(char *);
 int lateral_dir_visfile_isempty(char *);
 int lateral_dir_visfile_size(char *);
 int lateral_dir_visfile_count(char *);
 void rolling_umount(char *);
+void mount_tmpfs(char *);
 int real_username(char **);
 double frstr2double(char *);
+double bytestr2double(char *);
+double secstr2double(char *);
+int levelstr2int(char *);
+double mono_time();
+int cmp_double(const void *, const void *);
+void mono_sleep_until(double);
 int is_num_str(char *);
+void trace_open(char *);
+double trace_begin();
+void trace_end(char *, double);
+void trace_close();
 void sighandler(int);
 void die(char *);
 void dief(char *, ...);
 
 int term = 0;
+struct trace tr = { NULL, 0, PTHREAD_MUTEX_INITIALIZER, 0 }; // like term, needed everywhere
 
 int main(int argc, char *argv[])
 {
 	struct sigaction sa;
 	struct metadata md;
 	struct pathinfo pi;
-	char **files = NULL;
-	short int flags;
-	int nfiles;
-	double dfps;
+	struct playlist pl;
+	struct frameset fs = { 0 };
+	struct xdisplay xd = { 0 };
+	struct shedder sh = { 0 };
+	struct stat sb;
+	int flags, fit;
+	double dfps, t0, tcache = 0, start;
+
+	t0 = mono_time(); // ...for -b
 
 	if(argc == 1)
 	{
@@ -143,90 +448,355 @@ int main(int argc, char *argv[])
 	sigaction(SIGTERM, &sa, NULL);
 
 	// init1/2: allocate memory, set default values
-	swiper_init_pre(&md, &pi); 
+	swiper_init_pre(&md, &pi, &pl); 
 
 	opterr = 0;
 
 	// primarily for setting arguments via optarg
-	if((flags = swiper_parse_opts(argc, argv, &md, &pi)) < 0)
+	if((flags = swiper_parse_opts(argc, argv, &md, &pi, &pl)) < 0)
 		dief("duplicate option, -%c", flags);
 	else if(!flags)
 		die("unrecognised option or missing argument.");
+
+	// a directory of clips is saved as a batch, one library entry per clip
+	if(flags & F_SAVE && stat(pi.v_path, &sb) == 0 && S_ISDIR(sb.st_mode))
+		flags |= F_BATCH;
 	
 	// check directories exist, check options and args are valid format
-	swiper_safety_protocol(flags, &md, &pi);
+	swiper_safety_protocol(flags, &md, &pi, &pl);
 
 	// init2/2: flag and optarg reliant variables
 	swiper_init_post(flags, &md, &pi);
 
+	if(flags & F_TRACE)
+		trace_open(pi.t_path);
+	else if(getenv(TRACE_ENV) != NULL && *getenv(TRACE_ENV))
+		trace_open(getenv(TRACE_ENV));
+
 	// override and negate, -s, -a
-	if(flags & F_INSPECT)
+	if(flags & F_LIST)
+		swiper_list_library(pi.l_path);
+	else if(flags & F_INSPECT)
 	{
-		swiper_request_metadata(&md, pi.v_path); // ...original metadata
+		if(swiper_request_metadata(&md, pi.v_path) == -1) // ...original metadata
+			dief("extracting metadata from, '%s'", pi.v_path);
 		printf("metadata:\n\tname: %s\n", md.name);
 		swiper_print_md(&md, flags);
 	}
 	else // allow both -s, -a
 	{
-		if(flags & F_SAVE)
+		if(flags & F_BATCH)
+			swiper_execute_batch(&md, &pi, flags);
+		else if(flags & F_SAVE)
 		{
-			swiper_request_metadata(&md, pi.v_path); // ...custom metadata
+			if(swiper_request_metadata(&md, pi.v_path) == -1) // ...custom metadata
+				dief("extracting metadata from, '%s'", pi.v_path);
+			if(flags & F_BUDGET && (fit = swiper_fit_budget(&md, pi.v_path, flags)) == -1)
+				dief("failed to sample frames of, '%s'", pi.v_path);
+			else if(flags & F_BUDGET && fit == -2)
+				dief("can't fit frames of '%s' into %dKB; allow more with -B, or fewer of -r, -w, -h, -q",
+						pi.v_path, (int) (md.budget / 1e3));
 			cleardir(pi.s_path);
 			swiper_save_metadata(&md, &pi); // -a mode needs to know
 			printf("saving %s as:\n", md.name); 
 			swiper_print_md(&md, flags);
 			printf("this might take a while...\n");
-			swiper_render_frames(&md, &pi);
+			if(swiper_render_frames(&md, &pi, flags, 0, NULL) == -1)
+				die("ffmpeg failed to save frames");
 		}
-		if(flags & F_RUN)
+		if(flags & F_MONITORS)
+			XInitThreads(); // ...before any other Xlib call
+		if(flags & F_XLIB && flags & F_RUN)
+			x_open_display(&xd);
+		if(flags & F_VSYNC)
+			xd.refresh = x_refresh_rate(NULL);
+		if(flags & F_PLAYLIST)
+			swiper_execute_playlist(&pl, &md, &pi, &xd, flags);
+		else if(flags & F_RUN)
 		{
-			if(flags & F_CACHE) 
+			// a snapshot for -x needs neither the frames nor a cache of them
+			if(flags & F_CACHE && flags & F_XLIB && !(flags & (F_MCI|F_MONITORS))
+					&& swiper_open_snapshot(pi.s_path, xd.width, xd.height, NULL) == 0)
+				strncpy(pi.a_path, pi.s_path, PATH_LEN);
+			else if(flags & F_CACHE) 
 			{
-				rolling_umount(TFSMP); // protect against duplicate mounts
-
-				// change mount size by changing size=???, and value of MNT_SZ
-				if(mount("tmpfs", TFSMP, "tmpfs", 0, "size=1G,mode=0777") == -1)
-				{
-					printf("errno: %d\n", errno);
-					dief("failed to mount tmpfs at %s", TFSMP);
-				}
+				start = trace_begin();
+				mount_tmpfs(TFSMP);
 				cleardir(TFSMP);
 				printf("caching frames...\n");
+				tcache = mono_time();
 				copydir(pi.a_path, pi.s_path);
+				tcache = mono_time() - tcache;
+				trace_end("cache", start);
 			}
 			swiper_load_metadata(&md, flags, pi.s_path); // mainly to retrieve rfps
-			if((files = swiper_retrieve_image_names(&nfiles, pi.s_path, md.format)) == NULL)
-				die("low memory; manage system processes.");
-			dfps = frstr2double(md.pfps);
-			printf("applying wallpaper at %.2lffps:\n", dfps);
-			swiper_print_md(&md, flags); // <== this is why dot file stores not only rfps
-			if(flags & F_DAEMONIZE)
-				if(daemon(1, 0))
-					die("failed to daemonize process");
-			swiper_execute_wallpaper(files, nfiles, pi.a_path, dfps);
+			if(flags & F_MONITORS)
+				swiper_execute_monitors(&md, &pi, &xd, flags);
+			else
+			{
+				swiper_load_frameset(&fs, &md, &xd, pi.s_path, pi.a_path, flags);
+				dfps = swiper_cadence(frstr2double(md.pfps), &fs, &xd, flags);
+				printf("applying wallpaper at %.2lffps%s%s:\n", dfps, fs.delays ? " (variable)" : "",
+						(fs.loop != fs.n) ? " (boomerang)" : "");
+				swiper_print_md(&md, flags); // <== this is why dot file stores not only rfps
+				if(flags & F_DAEMONIZE)
+					if(daemon(1, 0))
+						die("failed to daemonize process");
+				if(flags & F_BENCH)
+					swiper_execute_bench(&fs, &md, &xd, t0, tcache, flags);
+				else if(flags & F_INTERP && !(flags & F_MCI))
+					swiper_execute_interpolated(&fs, &xd, dfps, -1);
+				else if(flags & F_PRESSURE)
+				{
+					sh.md = &md;
+					sh.s_path = pi.s_path;
+					sh.a_path = pi.a_path;
+					sh.flags = flags;
+					swiper_execute_wallpaper(&fs, &xd, dfps, -1, &sh);
+				}
+				else
+					swiper_execute_wallpaper(&fs, &xd, dfps, -1, NULL);
+			}
 		}
 	}
 
-	swiper_shutdown(&md, &pi, files, nfiles);
+	swiper_shutdown(&md, &pi, &pl, &fs, &xd);
+	trace_close();
 
 	return 0;
 }
 
+/* Save every clip in the directory pi->v_path into its own library entry,
+ * named after the clip without its extension. Clips are probed and extracted
+ * by a worker per available core, each starting only once the memory it is
+ * expected to take fits what is free, with one progress bar for all. */
+void swiper_execute_batch(struct metadata *md, struct pathinfo *pi, int flags)
+{
+	struct batch b;
+	struct dirent **ents;
+	struct stat sb;
+	struct job *jb;
+	pthread_t *tids;
+	char *bar, *dot;
+	double sum, fps, bytes, eta, start;
+	int nents, nw, cores, done = 0;
+
+	if((nents = scandir(pi->v_path, &ents, NULL, alphasort)) == -1)
+		dief("failed to open directory, '%s'", pi->v_path);
+	if((b.jobs = calloc(nents, sizeof(struct job))) == NULL)
+		die("low memory; manage system processes.");
+	b.n = 0;
+	for(int i = 0; i < nents; ++i)
+	{
+		jb = &b.jobs[b.n];
+		jb->pi.v_path = calloc(PATH_LEN+1, 1);
+		jb->pi.s_path = calloc(PATH_LEN+1, 1);
+		snprintf(jb->pi.v_path, PATH_LEN, "%s/%s", pi->v_path, ents[i]->d_name);
+		if(*(ents[i]->d_name) == '.' || stat(jb->pi.v_path, &sb) == -1 || !S_ISREG(sb.st_mode))
+		{
+			free(jb->pi.v_path); free(jb->pi.s_path);
+			continue;
+		}
+
+		// -w, -h, -r apply to every clip; the rest is probed per clip
+		jb->md.name = calloc(FILE_LEN+1, 1);
+		jb->md.rfps = calloc(FIELD_LEN+1, 1);
+		jb->md.pfps = NULL;
+		strncpy(jb->md.name, ents[i]->d_name, FILE_LEN);
+		strncpy(jb->md.rfps, md->rfps, FIELD_LEN);
+		strncpy(jb->md.format, md->format, 4);
+		jb->md.level = md->level;
+		jb->md.budget = md->budget;
+		jb->md.width = md->width;
+		jb->md.height = md->height;
+
+		snprintf(jb->pi.s_path, PATH_LEN, "%s/%s", pi->l_path, ents[i]->d_name);
+		if((dot = strrchr(jb->pi.s_path + strlen(pi->l_path) + 1, '.')) != NULL)
+			*dot = '\0';
+		for(int j = 0; j < b.n; ++j)
+			if(!strcmp(b.jobs[j].pi.s_path, jb->pi.s_path))
+				dief("clips, '%s' and '%s', would share a library entry", b.jobs[j].md.name, jb->md.name);
+		jb->pg.lock = &b.lock; // ...posted to by save threads, read here
+		b.n++;
+	}
+	for(int i = 0; i < nents; ++i)
+		free(ents[i]);
+	free(ents);
+	if(!b.n)
+		dief("no clips to save in, '%s'", pi->v_path);
+
+	// workers never outnumber cores; ffmpeg's own threads share what's left
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	nw = (b.n < cores) ? b.n : cores;
+	b.threads = (cores / nw > 1) ? cores / nw : 1;
+	b.budget = (size_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	b.reserved = 0;
+	b.next = 0;
+	b.flags = flags;
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.freed, NULL);
+
+	printf("saving %d clips from %s, %d at a time...\n", b.n, pi->v_path, nw);
+	if((tids = malloc(nw * sizeof(pthread_t))) == NULL || (bar = calloc(NUNITS+1, 1)) == NULL)
+		die("low memory; manage system processes.");
+	for(int i = 0; i < nw; ++i)
+		if(pthread_create(&tids[i], NULL, swiper_batch_worker, &b))
+			die("failed to start save worker");
+
+	// each clip counts equally, however long, as frames aren't known until probed
+	start = mono_time();
+	while(done < b.n && !term)
+	{
+		sum = fps = bytes = 0;
+		done = 0;
+		pthread_mutex_lock(&b.lock);
+		for(int i = 0; i < b.n; ++i)
+		{
+			jb = &b.jobs[i];
+			bytes += jb->pg.bytes;
+			if(jb->state >= 2)
+				done++;
+			else if(jb->state == 1 && jb->pg.nfr > 0)
+			{
+				sum += fmin(1, (double) jb->pg.frame / jb->pg.nfr);
+				fps += jb->pg.fps;
+			}
+		}
+		pthread_mutex_unlock(&b.lock);
+		sum = (done + sum) / b.n;
+		eta = (sum > 0) ? (mono_time() - start) * (1 - sum) / sum : 0;
+		progress_bar(bar, sum);
+		printf("\r%6.2lf%% %s %d/%d saved %6.1lffps %8.1lfMB eta %4.0lfs ", 
+				sum * 100, bar, done, b.n, fps, bytes / 1e6, eta);
+		fflush(stdout);
+		if(done < b.n)
+			usleep(250000);
+	}
+	printf("\n");
+
+	for(int i = 0; i < nw; ++i)
+		pthread_join(tids[i], NULL);
+	for(int i = 0; i < b.n; ++i)
+	{
+		jb = &b.jobs[i];
+		if(jb->state == 2 && jb->keep)
+			printf("\t%s -> %s (second half mirrors the first; kept %d frames)\n",
+					jb->md.name, strrchr(jb->pi.s_path, '/') + 1, jb->keep);
+		else if(jb->state == 2)
+			printf("\t%s -> %s\n", jb->md.name, strrchr(jb->pi.s_path, '/') + 1);
+		else if(jb->state == 3)
+			printf("\t%s: %s, skipped\n", jb->md.name, jb->why);
+		free(jb->pi.v_path); free(jb->pi.s_path);
+		free(jb->md.name); free(jb->md.rfps);
+	}
+	pthread_mutex_destroy(&b.lock);
+	pthread_cond_destroy(&b.freed);
+	free(b.jobs); free(tids); free(bar);
+}
+
+/* Take clips off the queue until it's empty, or terminated */
+void *swiper_batch_worker(void *arg)
+{
+	struct batch *b = arg;
+	struct job *jb;
+	size_t cost;
+	char *why;
+	int fit;
+
+	while(!term)
+	{
+		pthread_mutex_lock(&b->lock);
+		jb = (b->next < b->n) ? &b->jobs[b->next++] : NULL;
+		pthread_mutex_unlock(&b->lock);
+		if(jb == NULL)
+			break;
+
+		// one bad clip mustn't take down the saves of the rest
+		why = NULL;
+		if(!swiper_probe_video(jb->pi.v_path))
+			why = "no video stream found";
+		else if(swiper_request_metadata(&jb->md, jb->pi.v_path) == -1)
+			why = "failed to extract metadata";
+		else if(b->flags & F_BUDGET && (fit = swiper_fit_budget(&jb->md, jb->pi.v_path, b->flags)))
+			why = (fit == -1) ? "failed to sample frames" : "can't fit into -B";
+		if(why != NULL)
+		{
+			pthread_mutex_lock(&b->lock);
+			jb->why = why;
+			jb->state = 3;
+			pthread_mutex_unlock(&b->lock);
+			continue;
+		}
+
+		// frames buffered by ffmpeg's decoder and filters dominate what a save takes
+		cost = (size_t) jb->md.width * jb->md.height * 4 * JOB_FRAMES;
+		pthread_mutex_lock(&b->lock);
+		while(b->reserved && b->reserved + cost > b->budget)
+			pthread_cond_wait(&b->freed, &b->lock);
+		b->reserved += cost;
+		jb->state = 1;
+		pthread_mutex_unlock(&b->lock);
+
+		if(mkdir(jb->pi.s_path, 0700) == -1 && errno != EEXIST)
+			dief("failed to create directory, '%s'", jb->pi.s_path);
+		cleardir(jb->pi.s_path);
+		swiper_save_metadata(&jb->md, &jb->pi);
+		jb->keep = swiper_render_frames(&jb->md, &jb->pi, b->flags, b->threads, &jb->pg);
+
+		// ...and a clip ffmpeg failed on leaves no half-saved entry behind
+		if(jb->keep == -1)
+		{
+			cleardir(jb->pi.s_path);
+			rmdir(jb->pi.s_path);
+		}
+
+		pthread_mutex_lock(&b->lock);
+		b->reserved -= cost;
+		if(jb->keep == -1)
+		{
+			jb->why = "ffmpeg failed to save frames";
+			jb->pg.bytes = 0; // ...as there are none now
+			jb->state = 3;
+		}
+		else
+			jb->state = 2;
+		pthread_cond_broadcast(&b->freed);
+		pthread_mutex_unlock(&b->lock);
+	}
+	return NULL;
+}
+
 /* Help menu */
 void swiper_show_help()
 {
-    printf("usage: swiper [-i <video-file] [-s <video-file> [-r <render-fps>][-w <width>]\n\t[-h <height>][-P]] [-a [-d][-c][-p <playback-fps>]]\n");
+    printf("usage: swiper [-i <video-file] [-L] [-s <video-file> [-r <render-fps>][-w <width>]\n\t[-h <height>][-P [-Q <palette>]][-q <level>][-B <bytes>][-V]] [-a [-d][-c][-p <playback-fps>][-l <entries> [-t <seconds>]]\n\t[-x [-I <mode>][-v][-m][-M]]] [-o] [-n <entry>]\n");
 	printf("\t-i: inspect video metadata\n");
-    printf("\t-s: save live wallpaper\n");
+    printf("\t-s: save live wallpaper, or each clip in a directory as its own entry\n");
     printf("\t-P: save as png frames; jpeg by default (with -s)\n");
     printf("\t-w: width of resolution in pixels (with -s)\n");
     printf("\t-h: height of resolution in pixels (with -s)\n");
     printf("\t-r: set render fps (with -s)\n");
+    printf("\t-V: keep variable frame timing of source instead of -r (with -s)\n");
+    printf("\t-Q: quantise to a 'shared' or per 'frame' 256 colour palette (with -P)\n");
+    printf("\t-q: jpeg quality, 1 to 100, or png compression, 0 to 9 (with -s)\n");
+    printf("\t-B: fit fps, size and quality to bytes (e.g. 300M), or 'ram' to cache (with -s)\n");
     printf("\t-c: cache frames in memory (with -a)\n");
     printf("\n\t-a: apply saved wallpaper\n");
     printf("\t-d: daemonize process (with -a)\n");
     printf("\t-f: forcibly ignore duplicate processes\n");
     printf("\t-p: display at alternate playback fps (with -a)\n");
+    printf("\t-x: display in-process through X11 instead of feh (with -a)\n");
+    printf("\t-I: interpolate up to -p, by 'blend' or 'mci' (with -x)\n");
+    printf("\t-v: time frames to the display's refresh rate (with -x)\n");
+    printf("\t-m: play independently on each monitor (with -x)\n");
+    printf("\t-M: give frame memory back under memory pressure, and restore it after (with -x)\n");
+    printf("\t-o: play forward then backward; saved with the entry (with -s, -a)\n");
+    printf("\n\t-n: name of library entry to save or apply (with -s, -a)\n");
+    printf("\t-l: rotate between comma separated library entries (with -a)\n");
+    printf("\t-t: seconds per playlist entry; rotates at loop end by default (with -l)\n");
+    printf("\t-L: list saved library entries\n");
+    printf("\t-b: benchmark startup and per-frame display cost, as JSON (with -a)\n");
+    printf("\t-T: write a Chrome trace of where time goes to file (or set %s)\n", TRACE_ENV);
     printf("examples:\n");
     printf("\tswiper -s ~/Videos/234878.gif\n");
 	printf("\tswiper -i 05-06-97.avi\n");
@@ -236,6 +806,14 @@ void swiper_show_help()
     printf("\tswiper -adc\n");
     printf("\tswiper -s ../lightning.mp4 -adf\n");
     printf("\tswiper -s 90s-synth.gif -r 442/10 -P -ad -p 30\n");
+    printf("\tswiper -s ~/Videos/rain.mp4 -n rain\n");
+    printf("\tswiper -s ~/Videos/loops/ -P\n");
+    printf("\tswiper -s ./ocean-4k.mp4 -B ram -adc\n");
+    printf("\tswiper -a -l rain,90s-synth -t 300 -dc\n");
+    printf("\tswiper -s ./aurora.mp4 -r 12 -axd -I blend -p 48\n");
+    printf("\tswiper -s ./pixel-city.gif -P -Q shared -ax\n");
+    printf("\tswiper -axmv -n rain\n");
+    printf("\tswiper -s ./candle.mp4 -o -ax\n");
 	printf("\n%cWritten by laocid.\n", (unsigned char) 189);
 }
 
@@ -243,7 +821,7 @@ void swiper_show_help()
 void sighandler(int sig) { term = 1; }
 
 /* Protect against memory leaks */
-void swiper_shutdown(struct metadata *md, struct pathinfo *pi, char **files, int n)
+void swiper_shutdown(struct metadata *md, struct pathinfo *pi, struct playlist *pl, struct frameset *fs, struct xdisplay *xd)
 {
 	if(md->name != NULL)
 		free(md->name);
@@ -257,21 +835,32 @@ void swiper_shutdown(struct metadata *md, struct pathinfo *pi, char **files, int
 		free(pi->s_path);
 	if(pi->v_path != NULL)
 		free(pi->v_path);
-	if(files != NULL)
+	if(pi->l_path != NULL)
+		free(pi->l_path);
+	if(pi->e_name != NULL)
+		free(pi->e_name);
+	if(pi->t_path != NULL)
+		free(pi->t_path);
+	if(pl->names != NULL)
 	{
-		for(int i = 0; i < n; ++i) 
-        	free(files[i]);
-        free(files);
+		for(int i = 0; i < pl->n; ++i)
+			free(pl->names[i]);
+		free(pl->names);
 	}
+	swiper_free_frameset(fs);
+	if(xd->dpy != NULL)
+		x_close_display(xd);
 }
 
 /* Initial data initialisation */
-void swiper_init_pre(struct metadata *md, struct pathinfo *pi)
+void swiper_init_pre(struct metadata *md, struct pathinfo *pi, struct playlist *pl)
 {
 	char *username = NULL;
 
 	md->name = calloc(FILE_LEN+1, 1);
 	md->width = -1;
+	md->level = -1;
+	md->budget = 0;
 	md->height = -1;
 	md->rfps = calloc(FIELD_LEN+1, 1);
 	md->pfps = calloc(FIELD_LEN+1, 1);
@@ -280,17 +869,25 @@ void swiper_init_pre(struct metadata *md, struct pathinfo *pi)
 	pi->a_path = calloc(PATH_LEN+1, 1);
 	pi->s_path = calloc(PATH_LEN+1, 1);
 	pi->v_path = calloc(PATH_LEN+1, 1);
+	pi->l_path = calloc(PATH_LEN+1, 1);
+	pi->e_name = calloc(FILE_LEN+1, 1);
+	pi->t_path = calloc(PATH_LEN+1, 1);
+
+	pl->names = NULL;
+	pl->n = 0;
+	pl->period = 0;
 
 	if(real_username(&username))
 		die("failed to retrieve username");
-	snprintf(pi->s_path, PATH_LEN, "/home/%s/%s", username, SWIPER);
+	snprintf(pi->l_path, PATH_LEN, "/home/%s/%s", username, SWIPER);
+	strncpy(pi->s_path, pi->l_path, PATH_LEN); // legacy entry lives at library root
 	//free(username);
 }
 
 /* Init data with option arguments and detect duplicate options */
-short int swiper_parse_opts(int argc, char **argv, struct metadata *md, struct pathinfo *pi)
+int swiper_parse_opts(int argc, char **argv, struct metadata *md, struct pathinfo *pi, struct playlist *pl)
 {
-    short int flags = 0;
+    int flags = 0;
     int opt;
 
     while((opt = getopt(argc, argv, OPTSTR)) != -1)
@@ -316,6 +913,37 @@ short int swiper_parse_opts(int argc, char **argv, struct metadata *md, struct p
 				else { flags |= F_PFPS; strncat(md->pfps, optarg, FIELD_LEN); } break;
             case 'f': 
 				if(flags & F_FORCE) return -opt; else flags |= F_FORCE; break;
+            case 'n': if(flags & F_NAME) return -opt;
+				else { flags |= F_NAME; strncpy(pi->e_name, optarg, FILE_LEN);
+					snprintf(pi->s_path, PATH_LEN, "%s/%s", pi->l_path, pi->e_name); } break;
+            case 'l': if(flags & F_PLAYLIST) return -opt;
+				else { flags |= F_PLAYLIST; swiper_parse_playlist(pl, optarg); } break;
+            case 't': if(flags & F_PERIOD) return -opt;
+				else { flags |= F_PERIOD; pl->period = secstr2double(optarg); } break;
+            case 'L': if(flags & F_LIST) return -opt; else flags |= F_LIST; break;
+            case 'V': if(flags & F_VFR) return -opt; else flags |= F_VFR; break;
+            case 'b': if(flags & F_BENCH) return -opt; else flags |= F_BENCH; break;
+            case 'T': if(flags & F_TRACE) return -opt;
+				else { flags |= F_TRACE; strncpy(pi->t_path, optarg, PATH_LEN); } break;
+            case 'x': if(flags & F_XLIB) return -opt; else flags |= F_XLIB; break;
+            case 'v': if(flags & F_VSYNC) return -opt; else flags |= F_VSYNC; break;
+            case 'm': if(flags & F_MONITORS) return -opt; else flags |= F_MONITORS; break;
+            case 'M': if(flags & F_PRESSURE) return -opt; else flags |= F_PRESSURE; break;
+            case 'o': if(flags & F_BOOMERANG) return -opt; else flags |= F_BOOMERANG; break;
+            case 'I': if(flags & F_INTERP) return -opt;
+				else if(!strcmp(optarg, "blend")) flags |= F_INTERP;
+				else if(!strcmp(optarg, "mci")) flags |= F_INTERP|F_MCI;
+				else return 0;
+				break;
+            case 'q': if(flags & F_LEVEL) return -opt;
+				else { flags |= F_LEVEL; md->level = levelstr2int(optarg); } break;
+            case 'B': if(flags & F_BUDGET) return -opt;
+				else { flags |= F_BUDGET; md->budget = bytestr2double(optarg); } break;
+            case 'Q': if(flags & F_PALETTE) return -opt;
+				else if(!strcmp(optarg, "shared")) flags |= F_PALETTE;
+				else if(!strcmp(optarg, "frame")) flags |= F_PALETTE|F_PALFRAME;
+				else return 0;
+				break;
 			case '?':
 				return 0;
         }
@@ -327,7 +955,7 @@ short int swiper_parse_opts(int argc, char **argv, struct metadata *md, struct p
 /* Define option precedence and perform option and argument validation as
  * a safety net for successive code. Any future functions should refer to
  * this function to keep efficiency in mind. */
-void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinfo *pi)
+void swiper_safety_protocol(int flags, struct metadata *md, struct pathinfo *pi, struct playlist *pl)
 {
 	struct stat sb;
 
@@ -335,13 +963,22 @@ void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinf
 		if(is_duplicate_proc(SREGXP) > 1)
         	dief("duplicate process detected (like %s)", SREGXP);
 
+	if(flags & F_LIST)
+	{
+		if(flags & ~(F_LIST|F_FORCE))
+			die("must list (-L) as a standalone operation");
+		if(stat(pi->l_path, &sb) == -1)
+			die("no library found, use '-s <video-file> -n <entry>'");
+		return;
+	}
+
 	if(!(flags & F_SAVE) && !(flags & F_RUN) & !(flags & F_INSPECT))
 		die("must inspect (-i), save (-s), or apply wallpaper (-a)");
 	
 	if((flags & F_INSPECT) && (flags & (F_SAVE|F_RUN)))
 		die("must inspect (-i) as a standalone operation\n");
 	
-	if(!(flags & F_SAVE) && flags & (F_CACHE|F_RFPS|F_WIDTH|F_HEIGHT|F_PNG))
+	if(!(flags & F_SAVE) && flags & (F_CACHE|F_RFPS|F_WIDTH|F_HEIGHT|F_PNG|F_VFR|F_PALETTE|F_LEVEL|F_BUDGET))
 	{
 		if(flags & F_RFPS)
 			die("incompatible option, -r, requires -s");
@@ -351,6 +988,14 @@ void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinf
 			die("incompatible option, -h, requires -s");
 		if(flags & F_PNG)
 			die("incompatible option, -P, requires -s");
+		if(flags & F_VFR)
+			die("incompatible option, -V, requires -s");
+		if(flags & F_PALETTE)
+			die("incompatible option, -Q, requires -s");
+		if(flags & F_LEVEL)
+			die("incompatible option, -q, requires -s");
+		if(flags & F_BUDGET)
+			die("incompatible option, -B, requires -s");
 	}
 
 	if(!(flags & F_RUN) && flags & (F_RFPS|F_WIDTH|F_HEIGHT|F_PNG))
@@ -363,23 +1008,91 @@ void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinf
 			die("incompatible option, -p, requires -a");
 	}
 
+	if(flags & F_VFR && flags & F_RFPS)
+		die("incompatible options, -V and -r");
+	if(flags & F_PALETTE && !(flags & F_PNG))
+		die("incompatible option, -Q, requires -P"); // jpeg would add colours back
+	if(flags & F_XLIB && !(flags & F_RUN))
+		die("incompatible option, -x, requires -a");
+	if(flags & F_INTERP && !(flags & F_XLIB))
+		die("incompatible option, -I, requires -x");
+	if(flags & F_VSYNC && !(flags & F_XLIB))
+		die("incompatible option, -v, requires -x");
+	if(flags & F_MONITORS && !(flags & F_XLIB))
+		die("incompatible option, -m, requires -x");
+	if(flags & F_MONITORS && flags & (F_PLAYLIST|F_BENCH))
+		die("incompatible options, -m with -l or -b");
+	if(flags & F_PRESSURE && (!(flags & F_XLIB) || flags & (F_INTERP|F_MONITORS|F_PLAYLIST|F_BENCH)))
+		die("must watch memory pressure (-M) with -x, without -I, -m, -l, -b");
+	if(flags & F_INTERP && !(flags & F_PFPS))
+		die("must set the interpolated fps with -p, for -I");
+	if(flags & F_BENCH && (!(flags & F_RUN) || flags & (F_PLAYLIST|F_DAEMONIZE|F_INTERP)))
+		die("must benchmark (-b) a single wallpaper with -a, without -l, -d, -I");
+	if(flags & F_PLAYLIST && !(flags & F_RUN))
+		die("incompatible option, -l, requires -a");
+	if(flags & F_BOOMERANG && !(flags & (F_SAVE|F_RUN)))
+		die("incompatible option, -o, requires -s or -a");
+	if(flags & F_PERIOD && !(flags & F_PLAYLIST))
+		die("incompatible option, -t, requires -l");
+	if(flags & F_NAME && flags & F_PLAYLIST)
+		die("incompatible options, -n and -l");
+	if(flags & F_BATCH && flags & (F_RUN|F_NAME))
+		die("must save a directory (-s) without -a, -n; entries are named after clips");
+	if(flags & F_NAME && (*(pi->e_name) == '.' || strchr(pi->e_name, '/') != NULL))
+		dief("invalid library entry name, '%s'", pi->e_name);
+
 	if(flags & F_INSPECT || flags & F_SAVE)
 		if(stat(pi->v_path, &sb) == -1)
 			dief("no such file, '%s'", pi->v_path);
 		
 	if(flags & F_SAVE)
 	{
+		if(stat(pi->l_path, &sb) == -1)
+			mkdir(pi->l_path, 0700);
 		if(stat(pi->s_path, &sb) == -1)
 			mkdir(pi->s_path, 0700);
 
 		if(flags & F_RFPS)
 			if(!is_num_str(md->rfps))
 				dief("invalid format for argument of, -%c", 'r');
+		if(flags & F_LEVEL && (md->level < 0 || ((flags & F_PNG) ? md->level > 9 : (md->level < 1 || md->level > 100))))
+			die("invalid argument of, -q; 1 to 100 for jpeg, 0 to 9 for png");
+		if(flags & F_BUDGET && md->budget <= 0)
+			dief("invalid format for argument of, -%c", 'B');
+	}
+
+	if(flags & F_PLAYLIST)
+	{
+		char *e_path = calloc(PATH_LEN+1, 1);
+		int size, prev = 0;
+
+		if(pl->period < 0)
+			dief("invalid format for argument of, -%c", 't');
+		if(!pl->n)
+			die("empty playlist, use '-l <entry>,<entry>...'");
+		for(int i = 0; i <= pl->n; ++i)
+		{
+			snprintf(e_path, PATH_LEN, "%s/%s", pi->l_path, pl->names[i % pl->n]);
+			if(i && pl->n > 1 && !strcmp(pl->names[i % pl->n], pl->names[i - 1]))
+				dief("playlist entry, '%s', must not follow itself", pl->names[i - 1]);
+			if(*(pl->names[i % pl->n]) == '.' || stat(e_path, &sb) == -1 
+					|| !lateral_dir_visfile_count(e_path))
+				dief("no such library entry, '%s'", pl->names[i % pl->n]);
+
+			// current and preloaded entry share the tmpfs
+			size = lateral_dir_visfile_size(e_path);
+			if(flags & F_CACHE && i && size + prev >= MNT_SZ)
+				dief("not enough space to cache frames in %s", TFSMP);
+			prev = size;
+		}
+		free(e_path);
 	}
 
 	if(flags & F_RUN)
 	{
-		if(lateral_dir_visfile_isempty(pi->s_path))
+		// library entries are directories, so only count frames; with -s
+		// there are none until they're saved, so what's there is no guide
+		if(!(flags & (F_PLAYLIST|F_SAVE)) && !lateral_dir_visfile_count(pi->s_path))
 			die("no wallpaper saved, use '-s <video-file>'");
 
 		if(flags & F_PFPS)
@@ -391,7 +1104,7 @@ void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinf
 		{
 			if(getuid())
 				die("must run as superuser for, -c");
-			if(lateral_dir_visfile_size(pi->s_path) >= MNT_SZ)
+			if(!(flags & (F_PLAYLIST|F_SAVE)) && lateral_dir_visfile_size(pi->s_path) >= MNT_SZ)
 				dief("not enough space to cache frames in %s", TFSMP);
 			if(stat(TFSMP, &sb) == -1)
 				mkdir(TFSMP, 0700);
@@ -401,9 +1114,9 @@ void swiper_safety_protocol(short int flags, struct metadata *md, struct pathinf
 
 /* Init data which requires swiper_parse_opts() and swiper_safety_check()
  * to run first. */
-void swiper_init_post(short int flags, struct metadata *md, struct pathinfo *pi)
+void swiper_init_post(int flags, struct metadata *md, struct pathinfo *pi)
 {
-	if(flags & F_INSPECT || flags & F_SAVE)
+	if(flags & F_INSPECT || (flags & F_SAVE && !(flags & F_BATCH)))
 		strncpy(md->name, filename(pi->v_path), FILE_LEN);
 		
 	if(flags & F_CACHE)
@@ -518,6 +1231,79 @@ double frstr2double(char *frstr)
     return dfps;
 }
 
+/* Convert a byte count with an optional K, M or G suffix (e.g. 300M), or
+ * 'ram' for what is free and fits the cache at TFSMP, to bytes. Returns 0 if
+ * it isn't one. */
+double bytestr2double(char *bytestr)
+{
+	char *end;
+	double bytes;
+
+	if(!strcmp(bytestr, "ram"))
+		return fmin(MNT_SZ, (double) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE));
+	bytes = strtod(bytestr, &end);
+	switch(*end)
+	{
+		case 'K': bytes *= 1e3; end++; break;
+		case 'M': bytes *= 1e6; end++; break;
+		case 'G': bytes *= 1e9; end++; break;
+	}
+	return (*end == '\0') ? bytes : 0;
+}
+
+/* Convert a plain number of seconds (e.g. 300, 2.5) to seconds. Returns -1 if
+ * it isn't one, or has anything after it (e.g. 5m). */
+double secstr2double(char *secstr)
+{
+	char *end;
+	double secs;
+
+	secs = strtod(secstr, &end);
+	return (end != secstr && *end == '\0' && isfinite(secs) && secs >= 0) ? secs : -1;
+}
+
+/* Convert a plain whole number (e.g. 85) to an encoder level for -q. Returns
+ * -1 if it isn't one, or has anything after it (e.g. 9x). */
+int levelstr2int(char *levelstr)
+{
+	char *end;
+	long level;
+
+	errno = 0;
+	level = strtol(levelstr, &end, 10);
+	return (end != levelstr && *end == '\0' && !errno && level >= 0 && level <= 100) ? level : -1;
+}
+
+/* Seconds on the monotonic clock */
+double mono_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Ascending order of doubles, for qsort() */
+int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Sleep until the monotonic clock reaches t seconds; returns early on signals
+ * so term is noticed. */
+void mono_sleep_until(double t)
+{
+	struct timespec ts;
+	double start = trace_begin();
+
+	ts.tv_sec = (time_t) t;
+	ts.tv_nsec = (t - ts.tv_sec) * 1e9;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	trace_end("sleep", start);
+}
+
 /* Get filename of filepath; accepts relative paths as well */
 char *filename(char *filepath)
 {
@@ -541,6 +1327,31 @@ char *filename(char *filepath)
     return fn;
 }
 
+/* Quote str in single quotes for sh, so that nothing in it (spaces, $, `, ')
+ * is interpreted. Returns a new string. */
+char *shell_quote(char *str)
+{
+	char *q, *p;
+
+	if((q = malloc(strlen(str) * 4 + 3)) == NULL)
+		die("low memory; manage system processes.");
+	p = q;
+	*p++ = '\'';
+	for(; *str; ++str)
+	{
+		if(*str == '\'')
+		{
+			memcpy(p, "'\\''", 4); // ...close, escaped quote, reopen
+			p += 4;
+		}
+		else
+			*p++ = *str;
+	}
+	*p++ = '\'';
+	*p = '\0';
+	return q;
+}
+
 /* Determine whether or not a directory is empty */
 int lateral_dir_visfile_isempty(char *path)
 {
@@ -563,85 +1374,128 @@ int lateral_dir_visfile_size(char *dirpath)
 	DIR *dir = opendir(dirpath);
     struct dirent *ent;
     struct stat sb;
-    unsigned long int size;
+    unsigned long int size = 0;
     char *filepath;
 
     filepath = calloc(PATH_LEN+1, sizeof(char));
     
     while((ent = readdir(dir)) != NULL)
     {   
+        if(*(ent->d_name) == '.')
+            continue;
         snprintf(filepath, PATH_LEN, "%s/%s", dirpath, ent->d_name);
         stat(filepath, &sb);
         size += sb.st_size;
     }
 
-    closedir(dir);
+    closedir(dir); free(filepath);
     return size;
 }
 
-/* Fill struct metadata *md using ffprobe. */
-void swiper_request_metadata(struct metadata *md, char *v_path)
+/* Fill struct metadata *md using ffprobe. Returns -1 if a field couldn't
+ * be had, else 0. */
+int swiper_request_metadata(struct metadata *md, char *v_path)
 {
 	char *value;
+	double start = trace_begin();
 
-	value = swiper_resolve_mdfield(v_path, "duration");
+	if((value = swiper_resolve_mdfield(v_path, "duration")) == NULL)
+		return -1;
 	md->duration = atof(value); free(value);
 	if(md->width == -1)
 	{
-		value = swiper_resolve_mdfield(v_path, "width");
+		if((value = swiper_resolve_mdfield(v_path, "width")) == NULL)
+			return -1;
 		md->width = atoi(value); free(value);
 	}
 	if(md->height == -1)
 	{
-		value = swiper_resolve_mdfield(v_path, "height");
+		if((value = swiper_resolve_mdfield(v_path, "height")) == NULL)
+			return -1;
 		md->height = atoi(value); free(value); // why is there two 'height'
 	}
 	if(*(md->rfps) == '\0')
 	{
-		value = swiper_resolve_mdfield(v_path, "avg_frame_rate");
+		if((value = swiper_resolve_mdfield(v_path, "avg_frame_rate")) == NULL)
+			return -1;
 		strncpy(md->rfps, value, FIELD_LEN);
 		free(value);
 	}
+	trace_end("probe", start);
+	return 0;
 }
 
-/* Get values of metadata fields requested from ffprobe. */
+/* Get values of metadata fields requested from ffprobe, or NULL if it has
+ * none. */
 char *swiper_resolve_mdfield(char *v_path, char *field)
 {
 	FILE *fp;
-	char *cmd, *value;
-	int len = PATH_LEN+128;
+	char *cmd, *value, *qv;
+	int len = PATH_LEN*4+128;
 
 	cmd = calloc(len+1, 1);
 	value = calloc(LINE_LEN+1, 1);
+	qv = shell_quote(v_path);
 
-	snprintf(cmd, len, "ffprobe -v 0 -of csv=p=0 -select_streams v:0 -show_entries stream=%s %s", field, v_path);
+	snprintf(cmd, len, "ffprobe -v 0 -of csv=p=0 -select_streams v:0 -show_entries stream=%s %s", field, qv);
+	free(qv);
 
 	if((fp = popen(cmd, "r")) == NULL)
 		dief("failed to open pipe, '%s'", cmd);
 	if(fgets(value, LINE_LEN, fp) == NULL)
-		dief("extracting metadata from, '%s'", v_path);
+	{
+		pclose(fp); free(cmd); free(value);
+		return NULL;
+	}
 	value[strcspn(value, "\n")] = '\0';
-	pclose(fp);
+	pclose(fp); free(cmd);
 
 	return value;
 }
 
+/* Whether ffprobe finds a video stream in v_path, for a batch to tell what
+ * isn't a clip from one whose metadata fails to extract */
+int swiper_probe_video(char *v_path)
+{
+	FILE *fp;
+	char *cmd, *qv, line[LINE_LEN+1];
+	int len = PATH_LEN*4+128, width = 0;
+
+	cmd = calloc(len+1, 1);
+	qv = shell_quote(v_path);
+	snprintf(cmd, len, "ffprobe -v 0 -of csv=p=0 -select_streams v:0 -show_entries stream=width %s", qv);
+	if((fp = popen(cmd, "r")) != NULL)
+	{
+		if(fgets(line, LINE_LEN, fp) != NULL)
+			width = atoi(line);
+		pclose(fp);
+	}
+	free(cmd); free(qv);
+	return width > 0;
+}
+
 /* Save data in struct metadata *md at MDFN (see macros). */
 void swiper_save_metadata(struct metadata *md, struct pathinfo *pi)
 {
 	FILE *fp;
-	char *filepath;
+	char *filepath, *name;
 
 	filepath = calloc(PATH_LEN+1, 1);
 	snprintf(filepath, PATH_LEN, "%s/%s", pi->s_path, MDFN);
 	if((fp = fopen(filepath, "w")) == NULL)
 		dief("failed to open file, '%s'", filepath);
-	fprintf(fp, "%s %s %d %d %.4lf %s", md->name, md->rfps, md->width, md->height, md->duration, md->format);
-	fclose(fp); free(filepath);
+
+	// fields are space separated, and a clip's name may have spaces
+	name = strdup(md->name);
+	for(char *c = name; *c; ++c)
+		if(strchr(" \t\n", *c) != NULL)
+			*c = '_';
+	fprintf(fp, "%s %s %d %d %.4lf %s", name, md->rfps, md->width, md->height, md->duration, md->format);
+	fclose(fp); free(filepath); free(name);
 }
 
 /* Print metadata of video with units */
-void swiper_print_md(struct metadata *md, short int flags)
+void swiper_print_md(struct metadata *md, int flags)
 {
 		printf("\twidth: %dpx\n", md->width);
 		printf("\theight: %dpx\n", md->height);
@@ -662,6 +1516,7 @@ void cleardir(char *dirpath)
 	DIR *dir;
 	struct dirent *ent;
 	char *filepath;
+	double start = trace_begin();
 
 	if((dir = opendir(dirpath)) == NULL)
 		dief("failed to open directory, '%s'", dirpath);
@@ -669,157 +1524,744 @@ void cleardir(char *dirpath)
 	while((ent = readdir(dir)) != NULL)
 	{
 		snprintf(filepath, PATH_LEN, "%s/%s", dirpath, ent->d_name);
-		if(strcmp(ent->d_name, "..") && strcmp(ent->d_name, "."))
+		// library entries share the directory of the legacy wallpaper
+		if(strcmp(ent->d_name, "..") && strcmp(ent->d_name, ".") && ent->d_type != DT_DIR)
 			remove(filepath);
 	}
+	closedir(dir); free(filepath);
+	trace_end("cleardir", start);
 }
 
-/* Convert video file into many image frames and store at pi->s_path */
-void swiper_render_frames(struct metadata *md, struct pathinfo *pi)
+/* Convert video file into many image frames and store at pi->s_path. Returns
+ * how many frames were kept of a boomerang folded in half (for -o), else 0,
+ * or -1 if ffmpeg failed, for the caller to die on or, in a batch, to skip
+ * the clip. */
+int swiper_render_frames(struct metadata *md, struct pathinfo *pi, int flags, int threads, struct progress *pg)
 {
-	int nfr, len; 
-	char *cmd;
+	FILE *fp;
+	int nfr, len, keep = 0; 
+	char *cmd, *filter, *out, *pal, *qv, *qs, *qp = NULL, thr[FIELD_LEN+1] = "", rate[FIELD_LEN+1];
+	double start = trace_begin();
 
-	len = (PATH_LEN * 2) + 32;
+	len = (PATH_LEN * 12) + 256; // ...paths quoted for the shell take up to 4x
 	cmd = calloc(len+1, 1);
+	filter = calloc(LINE_LEN+1, 1);
+	out = calloc(PATH_LEN*4+LINE_LEN+1, 1);
+	pal = calloc(PATH_LEN+LINE_LEN+1, 1);
+	qv = shell_quote(pi->v_path);
+	qs = shell_quote(pi->s_path);
+
+	// ...for decoding and encoding alike; ffmpeg decides if 0
+	if(threads)
+		snprintf(thr, FIELD_LEN, "-threads %d ", threads);
+
+	// one image per source frame, timed by TMFN, for -V
+	if(flags & F_VFR)
+		snprintf(rate, FIELD_LEN, "-fps_mode passthrough");
+	else
+		snprintf(rate, FIELD_LEN, "-r %s", md->rfps);
 
-	snprintf(cmd, len, "ffmpeg -i %s -r %s -vf scale=%d:%d %s/%%04d.%s -hide_banner 2>&1", pi->v_path, md->rfps, md->width, md->height, pi->s_path, md->format);
+	snprintf(filter, LINE_LEN, "scale=%d:%d", md->width, md->height);
+	if(flags & F_PALETTE) // pal8 png frames, indexed again when decoded for -x
+	{
+		snprintf(cmd, len, "%s/%s", pi->s_path, PLFN);
+		if((fp = fopen(cmd, "w")) == NULL)
+			dief("failed to open file, '%s'", cmd);
+		fprintf(fp, "%s", (flags & F_PALFRAME) ? "frame" : "shared");
+		fclose(fp);
+	}
+	if(flags & F_PALFRAME) // ...each made and used as its frame goes by
+		snprintf(filter + strlen(filter), LINE_LEN - strlen(filter), 
+				",split[a][b];[a]palettegen=stats_mode=single[p];[b][p]paletteuse=new=1");
+	else if(flags & F_PALETTE)
+	{
+		// a shared palette is only known once every frame has been seen, so it
+		// is made by a pass of its own instead of ffmpeg holding every frame
+		snprintf(pal, PATH_LEN+LINE_LEN, "%s/%s", pi->s_path, PGFN);
+		qp = shell_quote(pal);
+		snprintf(cmd, len, "ffmpeg %s-i %s %s%s -vf '%s,palettegen=stats_mode=full' -v error -nostats -y %s",
+				thr, qv, thr, rate, filter, qp);
+		if(pg == NULL)
+			printf("generating palette...\n");
+		if(system(cmd) && !term)
+			keep = -1;
+		snprintf(filter + strlen(filter), LINE_LEN - strlen(filter), "[x];[x][1:v]paletteuse");
+	}
 
-	// truncation is trivial
-	nfr = md->duration * frstr2double(md->rfps);
+	// palettes are ffmpeg's, so it writes -Q frames itself; the rest are
+	// decoded once and encoded by swiper_encode_frames()
+	// (output options go before the file they apply to, or ffmpeg drops them)
+	if(flags & F_PALETTE)
+		snprintf(out, PATH_LEN*4+LINE_LEN, "-compression_level %d -v error -nostats -progress pipe:1 %s/%%04d.%s",
+				(md->level >= 0) ? md->level : PNG_LEVEL, qs, md->format);
+	else
+		snprintf(out, PATH_LEN*4+LINE_LEN, "-f rawvideo -pix_fmt rgb24 -v error -nostats -");
 
-	swiper_save_action(cmd, nfr);
+	// ...with the palette as a second input, for -Q shared
+	if(qp != NULL)
+		snprintf(cmd, len, "ffmpeg %s-i %s -i %s %s%s -filter_complex '%s' %s", thr, qv, qp, thr, rate, filter, out);
+	else
+		snprintf(cmd, len, "ffmpeg %s-i %s %s%s -vf '%s' %s", thr, qv, thr, rate, filter, out);
+
+	if(keep == -1)
+		nfr = -1;
+	else if(flags & F_VFR)
+		nfr = swiper_save_timing(md, pi);
+	else // truncation is trivial
+		nfr = md->duration * frstr2double(md->rfps);
+
+	if(nfr == -1)
+		keep = -1;
+	else if(flags & F_PALETTE)
+		keep = swiper_save_action(cmd, nfr, pi->s_path, pg);
+	else
+		keep = swiper_encode_frames(cmd, md, pi->s_path, nfr, threads, pg);
+	if(*pal)
+		remove(pal);
+
+	// a boomerang that plays back into itself needs only its first half;
+	// anything else is kept whole, as a clip is only ever played backward
+	// if asked to
+	if(keep != -1 && (term || !(flags & F_BOOMERANG)))
+	{
+		if(keep && !term && pg == NULL)
+			printf("second half mirrors the first; save with -o to keep only %d frames\n", keep);
+		keep = 0;
+	}
+	else if(keep != -1)
+	{
+		swiper_fold_frames(pi->s_path, md->format, keep);
+		if(keep && pg == NULL)
+			printf("second half mirrors the first; kept %d frames, played forward then back\n", keep);
+	}
+	free(cmd); free(filter); free(out); free(pal); free(qv); free(qs); free(qp);
+	trace_end("render", start);
+	return keep;
 }
 
-/* Run ffmpeg to convert video into image frames, and parse output into an
- * ASCII progress bar. */
-void swiper_save_action(char *cmd, int nfr)
+/* Save how long each source frame is presented for, in seconds, at TMFN (see
+ * macros), one line per frame. Returns the number of frames, or -1 if ffprobe
+ * found no timestamps. */
+int swiper_save_timing(struct metadata *md, struct pathinfo *pi)
 {
-	FILE *fp;
-    int fd, x, frame;
-    size_t len;
-    char *long_line, *bar, c[1];
-    double pcnt;
+	FILE *pp, *fp;
+	char *cmd, *filepath, *qv, line[LINE_LEN+1];
+	double *pts = NULL, step, fps = frstr2double(md->rfps);
+	int n = 0, cap = 0, len = PATH_LEN*4+128;
 
-    len = LINE_LEN * 2;
-    long_line = malloc(len+1);
+	cmd = calloc(len+1, 1);
+	filepath = calloc(PATH_LEN+1, 1);
+	qv = shell_quote(pi->v_path);
 
-    if((fp = popen(cmd, "r")) == NULL) { die("popen()"); }
-    fd = fileno(fp); // blocking for popen() only works with read()
+	// packets are read without being decoded, but come in decode order
+	snprintf(cmd, len, "ffprobe -v 0 -of csv=p=0 -select_streams v:0 -show_entries packet=pts_time %s", qv);
+	free(qv);
+	snprintf(filepath, PATH_LEN, "%s/%s", pi->s_path, TMFN);
 
-	// skip output until got "frame = ..." line
-    while(strstr(long_line, MATCH_STR) == NULL)
-    {
-        memset(long_line, '\0', len+1);
-        *c = 1;
-        for(x = 0; *c != '\n' && *c != '\r' && x < len; ++x) 
-        {
-            read(fd, (void *) c, 1); 
-            long_line[x] = *c; 
-        }
-        if(x >= len)
-            die("unexpected ffmpeg output");
-    }   
+	if((pp = popen(cmd, "r")) == NULL)
+		dief("failed to open pipe, '%s'", cmd);
+	step = (fps > 0) ? 1 / fps : 0;
+	while(fgets(line, LINE_LEN, pp) != NULL)
+	{
+		if(n == cap && (pts = realloc(pts, (cap = cap ? cap * 2 : 1024) * sizeof(double))) == NULL)
+			die("low memory; manage system processes.");
+		// a packet without one (N/A) is still a frame, so it is put a nominal
+		// frame after the one before it, to keep line i the delay of frame i
+		if(sscanf(line, "%lf", &pts[n]) != 1)
+			pts[n] = n ? pts[n - 1] + step : 0;
+		n++;
+	}
+	pclose(pp);
+	if(!n)
+	{
+		free(cmd); free(filepath);
+		return -1;
+	}
+	qsort(pts, n, sizeof(double), cmp_double);
 
-    bar = calloc(NUNITS+1, 1); 
-    do  
-    {   
-        strtok(long_line, "="); 
-        sscanf(strtok(NULL, "="), " %d ", &frame);
+	if((fp = fopen(filepath, "w")) == NULL)
+		dief("failed to open file, '%s'", filepath);
 
-		// NUNITS is mutable, but if longer than printf line, it won't overwrite progress bar
-        for(int j = 0; j < NUNITS; ++j) 
-        {
-            if((double) frame / nfr >= (double) j / NUNITS)
-                bar[j] = '#';
-            else
-                bar[j] = '-';
-        }
-        if(x >= len) // dangerous exit condition (could also signify unexpected output)
-		    pcnt = 100.00;
+	// each frame lasts until the next one's timestamp...
+	for(int i = 1; i < n; ++i)
+		fprintf(fp, "%.6lf\n", pts[i] - pts[i - 1]);
 
-        pcnt = ((double) frame / nfr) * 100;
+	// ...and the last one until the end of the video
+	fprintf(fp, "%.6lf\n", (md->duration > pts[n - 1]) ? md->duration - pts[n - 1] : step);
 
-		// don't make NUNITS longer than this
-        printf("\r%3.2lf%% %s", (pcnt >= 100) ? 100.00 : pcnt, bar); 
-        fflush(stdout);
+	fclose(fp); free(cmd); free(filepath); free(pts);
 
-        memset(long_line, '\0', len+1);
-        *c = 1;
-        for(x = 0; *c != '\r' && x < len; ++x)
-        {
-            read(fd, c, 1);
-            long_line[x] = *c;
-        }
-    } while(pcnt < 100.00);
-    fflush(stdin); // carriage return line is not always instantaneous
-    printf("\n");
-    pclose(fp);
+	return n;
 }
 
-/* Unmounts all mounted filesystems at some mount point, char *mp */
-void rolling_umount(char *mp)
+/* Read per-frame delays of n frames from TMFN (see macros) at s_path, sped up
+ * by pfps / rfps. Returns NULL if the wallpaper was saved at a constant frame
+ * rate. */
+double *swiper_load_timing(char *s_path, int n, double speed)
 {
-    struct mntent *me;
-    FILE *ptr;
+	FILE *fp;
+	char *filepath;
+	double *delays, last = 0;
 
-    ptr = setmntent("/etc/mtab", "r+");
-    while((me = getmntent(ptr)) != NULL)
-    {
-        if(!strcmp(mp, me->mnt_dir))
-            umount(mp);
-    }
-    endmntent(ptr);
-}
+	filepath = calloc(PATH_LEN+1, 1);
+	snprintf(filepath, PATH_LEN, "%s/%s", s_path, TMFN);
+	fp = fopen(filepath, "r");
+	free(filepath);
+	if(fp == NULL)
+		return NULL;
 
-/* Copy files in a directory to another directory without recursion. */
-void copydir(char *dst, char *src)
-{
-    DIR *dir = opendir(src);
-    struct dirent *ent;
-    FILE *sptr, *dptr;
-    char sfile[PATH_LEN+1], dfile[PATH_LEN+1];
-    int c;
+	if((delays = malloc(n * sizeof(double))) == NULL)
+		die("low memory; manage system processes.");
+	for(int i = 0; i < n; ++i)
+	{
+		// frames beyond the table (shouldn't happen) repeat the last delay
+		if(fscanf(fp, "%lf", &delays[i]) != 1 || delays[i] < 0)
+			delays[i] = last;
+		else
+			delays[i] /= speed;
+		last = delays[i];
+	}
+	fclose(fp);
 
-    while((ent = readdir(dir)) != NULL)
-    {
-        if(strcmp(ent->d_name, "..") && strcmp(ent->d_name, ".") && ent->d_type == DT_REG)
-        {
-            snprintf(sfile, PATH_LEN, "%s/%s", src, ent->d_name);
-            snprintf(dfile, PATH_LEN, "%s/%s", dst, ent->d_name);
-            if((sptr = fopen(sfile, "r")) == NULL)
-				dief("failed to open, '%s'", sfile);
-            if((dptr = fopen(dfile, "w")) == NULL)
-				dief("failed to open, '%s'", dfile);
-            while((c = fgetc(sptr)) != EOF)
-                fputc(c, dptr);
-            fclose(sptr);
-            fclose(dptr);
-        }
-    }
+	return delays;
 }
 
-/* Store file names of video frames in an array. */
-char **swiper_retrieve_image_names(int *nfiles, char *dirpath, char *format)
+/* Lower the render fps, resolution and encoder quality of md, where not set
+ * by -r (or -V), -w, -h and -q, a step at a time and in turn, until frames of
+ * v_path are estimated to fit md->budget bytes. The size of a frame is taken
+ * from a sample encode, redone whenever resolution or quality change.
+ * Returns -1 if frames couldn't be sampled, -2 if they can't be made to fit,
+ * else 0. */
+int swiper_fit_budget(struct metadata *md, char *v_path, int flags)
 {
-	DIR *dir;
-	struct dirent *ent;
-	int len;
-	char **files;
+	double fps, size, budget = md->budget;
+	int png, level, knob = 0, moved, resample = 0;
 
-	dir = opendir(dirpath);
-	*nfiles = lateral_dir_visfile_count(dirpath);
-	len = (sizeof(int) * 4) + 5;
+	png = !strcmp(md->format, "png");
+	level = (md->level >= 0) ? md->level : (png ? PNG_LEVEL : JPEG_QUALITY);
+	fps = frstr2double(md->rfps);
+	if((size = swiper_sample_frame_size(md, v_path, level)) < 0)
+		return -1;
 
-	// cap frames at 9999 (like %04d), or cause overflow later in function
-	if(*nfiles > 9999) 
+	while(size * md->duration * fps > budget)
 	{
-		swiper_shave_s_path(dirpath, *nfiles, format);
-		*nfiles = 9999;
+		moved = 0;
+		for(int k = 0; k < 3 && !moved; ++k, knob = (knob + 1) % 3)
+		{
+			if(knob == 0 && !(flags & F_LEVEL) && (png ? level < 9 : level > FIT_MIN_QUALITY))
+			{
+				level = png ? 9 : fmax(FIT_MIN_QUALITY, level - 10); // compression is all png has
+				moved = resample = 1;
+			}
+			else if(knob == 1 && !(flags & (F_RFPS|F_VFR)) && fps * 0.8 >= FIT_MIN_FPS)
+			{
+				fps *= 0.8; // ...which frame size doesn't depend on
+				moved = 1;
+			}
+			else if(knob == 2 && !(flags & (F_WIDTH|F_HEIGHT)) && md->width * 0.8 >= FIT_MIN_WIDTH)
+			{
+				md->width = round(md->width * 0.4) * 2; // ...even, for chroma subsampling
+				md->height = round(md->height * 0.4) * 2;
+				moved = resample = 1;
+			}
+		}
+		if(!moved)
+			return -2;
+		if(resample && (size = swiper_sample_frame_size(md, v_path, level)) < 0)
+			return -1;
+		resample = 0;
 	}
 
-	files = (char **) malloc(*nfiles * sizeof(char *));
-	if(files == NULL)
+	md->level = level;
+	if(fps != frstr2double(md->rfps))
+		snprintf(md->rfps, FIELD_LEN, "%.3lf", fps);
+	if(!(flags & F_BATCH)) // ...which draws its own progress
+		printf("fit to %.1lfMB: %dx%d at %.2lffps, %s %d, about %.1lfMB\n", budget / 1e6, md->width, md->height,
+				fps, png ? "compression" : "quality", level, size * md->duration * fps / 1e6);
+	return 0;
+}
+
+/* Average size in bytes of a frame of v_path encoded at the size and format of
+ * md, and level, from SAMPLE_FRAMES (see macros) frames spread over the clip,
+ * or -1 if none could be decoded */
+double swiper_sample_frame_size(struct metadata *md, char *v_path, int level)
+{
+	FILE *fp;
+	unsigned char *raw, *enc;
+	char *cmd, *qv;
+	size_t size, sum = 0;
+	int n = 0, len = PATH_LEN*4 + 256;
+	double start = trace_begin();
+
+	size = (size_t) md->width * md->height * 3;
+	cmd = calloc(len+1, 1);
+	qv = shell_quote(v_path);
+	if((raw = malloc(size)) == NULL)
+		die("low memory; manage system processes.");
+
+	for(int i = 0; i < SAMPLE_FRAMES; ++i)
+	{
+		snprintf(cmd, len, "ffmpeg -v error -ss %.3lf -i %s -frames:v 1 -vf scale=%d:%d -f rawvideo -pix_fmt rgb24 -",
+				md->duration * (i + 0.5) / SAMPLE_FRAMES, qv, md->width, md->height);
+		if((fp = popen(cmd, "r")) == NULL)
+			dief("failed to open pipe, '%s'", cmd);
+		if(fread(raw, 1, size, fp) == size)
+		{
+			sum += !strcmp(md->format, "png") ? png_encode(&enc, raw, md->width, md->height, level)
+					: jpeg_encode(&enc, raw, md->width, md->height, level);
+			free(enc);
+			n++;
+		}
+		pclose(fp);
+	}
+	free(cmd); free(raw); free(qv);
+	trace_end("sample", start);
+	return n ? (double) sum / n : -1;
+}
+
+/* Run ffmpeg to convert video into image frames, reading its -progress
+ * stream (blocks of "key=value" lines, each ended by a "progress" key) into
+ * pg, or into an ASCII progress bar with frames/s, bytes written, speed and
+ * ETA if NULL. Done when ffmpeg exits, however many of the nfr frames
+ * expected it made; bytes are counted at dir if ffmpeg can't tell. Returns -1
+ * if ffmpeg failed, else 0. */
+int swiper_save_action(char *cmd, int nfr, char *dir, struct progress *pg)
+{
+	FILE *fp;
+	struct progress cur = { 0 };
+	char line[LINE_LEN+1], *val, *bar;
+	int status;
+
+	cur.nfr = nfr;
+
+	if((fp = popen(cmd, "r")) == NULL)
+		dief("failed to open pipe, '%s'", cmd);
+	bar = calloc(NUNITS+1, 1);
+
+	while(fgets(line, LINE_LEN, fp) != NULL)
+	{
+		line[strcspn(line, "\n")] = '\0';
+		if((val = strchr(line, '=')) == NULL)
+			continue;
+		*val++ = '\0';
+
+		// values not known yet are "N/A", which read as 0
+		if(!strcmp(line, "frame"))
+			cur.frame = atoi(val);
+		else if(!strcmp(line, "fps"))
+			cur.fps = atof(val);
+		else if(!strcmp(line, "total_size"))
+			cur.bytes = atoll(val);
+		else if(!strcmp(line, "speed")) // e.g. "2.37x"
+			cur.speed = atof(val);
+		else if(!strcmp(line, "progress")) // ...end of a block
+		{
+			if(!cur.bytes && dir != NULL) // image sequences have no one output size
+				cur.bytes = lateral_dir_visfile_size(dir);
+			cur.eta = (cur.fps > 0 && nfr > cur.frame) ? (nfr - cur.frame) / cur.fps : 0;
+			if(pg != NULL)
+				swiper_post_progress(pg, &cur);
+			else
+				swiper_draw_progress(&cur, bar);
+		}
+	}
+	status = pclose(fp);
+	if(pg == NULL)
+		printf("\n");
+	free(bar);
+
+	// ffmpeg is interrupted along with swiper
+	if(!term && (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status)))
+		return -1;
+	return 0;
+}
+
+/* Draw pg as an ASCII progress bar, with frames/s, bytes written, speed and
+ * ETA, over the last one drawn */
+void swiper_draw_progress(struct progress *pg, char *bar)
+{
+	progress_bar(bar, (double) pg->frame / pg->nfr);
+	printf("\r%6.2lf%% %s %6.1lffps %8.1lfMB %6.2lfx eta %4.0lfs ", fmin(100, 100.0 * pg->frame / pg->nfr),
+			bar, pg->fps, pg->bytes / 1e6, pg->speed, pg->eta);
+	fflush(stdout);
+}
+
+/* Copy cur to pg, which another thread reads, under pg->lock if it has one */
+void swiper_post_progress(struct progress *pg, struct progress *cur)
+{
+	pthread_mutex_t *lock = pg->lock;
+
+	if(lock != NULL)
+		pthread_mutex_lock(lock);
+	*pg = *cur;
+	pg->lock = lock;
+	if(lock != NULL)
+		pthread_mutex_unlock(lock);
+}
+
+/* Run ffmpeg's cmd, which writes rgb24 frames of md's size to stdout, and
+ * encode them as md->format into s_path by a pool of threads (one per core if
+ * threads is 0), while frames are still being decoded. Frames are written in
+ * order, so those saved are always 0001 to some n, even if interrupted.
+ * Progress goes into pg, or is drawn if NULL. Returns how many of the frames
+ * replay the clip walked forward then back (see swiper_mirror_frames()), or 0,
+ * or -1 if ffmpeg failed. */
+int swiper_encode_frames(char *cmd, struct metadata *md, char *s_path, int nfr, int threads, struct progress *pg)
+{
+	FILE *fp;
+	struct encoder en;
+	pthread_t *tids;
+	size_t size;
+	int nw, i, w = 0, s, status, keep;
+
+	en.pg = pg;
+	memset(&en.cur, 0, sizeof(struct progress));
+	en.cur.nfr = nfr;
+	en.bar = (pg == NULL) ? calloc(NUNITS+1, 1) : NULL;
+	en.spf = (nfr > 0) ? md->duration / nfr : 0;
+	en.shown = 0;
+
+	nw = threads ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+	en.nslot = 2 * nw; // ...so each encoder has a frame waiting as it finishes one
+	en.width = md->width;
+	en.height = md->height;
+	en.png = !strcmp(md->format, "png");
+	en.level = (md->level >= 0) ? md->level : (en.png ? PNG_LEVEL : JPEG_QUALITY);
+	en.eof = 0;
+	en.sigs = NULL;
+	size = (size_t) en.width * en.height * 3;
+
+	if((en.raw = calloc(en.nslot, sizeof(unsigned char *))) == NULL
+			|| (en.enc = calloc(en.nslot, sizeof(unsigned char *))) == NULL
+			|| (en.len = calloc(en.nslot, sizeof(size_t))) == NULL
+			|| (en.frame = calloc(en.nslot, sizeof(int))) == NULL
+			|| (en.state = calloc(en.nslot, sizeof(int))) == NULL
+			|| (en.sig = malloc(en.nslot * SIG_SIDE * SIG_SIDE)) == NULL
+			|| (tids = malloc(nw * sizeof(pthread_t))) == NULL)
+		die("low memory; manage system processes.");
+	for(s = 0; s < en.nslot; ++s)
+		if((en.raw[s] = malloc(size)) == NULL)
+			die("low memory; manage system processes.");
+	pthread_mutex_init(&en.lock, NULL);
+	pthread_cond_init(&en.cond, NULL);
+
+	if((fp = popen(cmd, "r")) == NULL)
+		dief("failed to open pipe, '%s'", cmd);
+	en.start = mono_time();
+	for(int j = 0; j < nw; ++j)
+		if(pthread_create(&tids[j], NULL, swiper_encode_worker, &en))
+			die("failed to start encoder thread");
+
+	pthread_mutex_lock(&en.lock);
+	for(i = 0; ; ++i)
+	{
+		// frame i's slot is freed once frame i - nslot is written, by us
+		s = i % en.nslot;
+		while(en.state[s] != 0)
+		{
+			if(en.state[w % en.nslot] == 3)
+				swiper_write_frame(&en, w++, s_path, md->format);
+			else
+				pthread_cond_wait(&en.cond, &en.lock);
+		}
+		pthread_mutex_unlock(&en.lock);
+		if(fread(en.raw[s], 1, size, fp) != size)
+		{
+			pthread_mutex_lock(&en.lock);
+			break;
+		}
+		pthread_mutex_lock(&en.lock);
+		en.frame[s] = i;
+		en.state[s] = 1;
+		pthread_cond_broadcast(&en.cond);
+	}
+	en.eof = 1;
+	pthread_cond_broadcast(&en.cond);
+	while(w < i)
+	{
+		if(en.state[w % en.nslot] == 3)
+			swiper_write_frame(&en, w++, s_path, md->format);
+		else
+			pthread_cond_wait(&en.cond, &en.lock);
+	}
+	pthread_mutex_unlock(&en.lock);
+
+	for(int j = 0; j < nw; ++j)
+		pthread_join(tids[j], NULL);
+	status = pclose(fp);
+	if(en.bar != NULL)
+	{
+		swiper_draw_progress(&en.cur, en.bar);
+		printf("\n");
+		free(en.bar);
+	}
+	if(!term && (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) || !i))
+		keep = -1;
+	else
+		keep = swiper_mirror_frames(en.sigs, w);
+
+	for(s = 0; s < en.nslot; ++s)
+		free(en.raw[s]);
+	pthread_mutex_destroy(&en.lock);
+	pthread_cond_destroy(&en.cond);
+	free(en.raw); free(en.enc); free(en.len); free(en.frame); free(en.state);
+	free(en.sig); free(en.sigs); free(tids);
+
+	return keep;
+}
+
+/* Encode decoded frames, earliest first, until there are no more */
+void *swiper_encode_worker(void *arg)
+{
+	struct encoder *en = arg;
+	int s;
+
+	pthread_mutex_lock(&en->lock);
+	while(1)
+	{
+		s = -1;
+		for(int j = 0; j < en->nslot; ++j)
+			if(en->state[j] == 1 && (s == -1 || en->frame[j] < en->frame[s]))
+				s = j;
+		if(s == -1)
+		{
+			if(en->eof)
+				break;
+			pthread_cond_wait(&en->cond, &en->lock);
+			continue;
+		}
+		en->state[s] = 2;
+		pthread_mutex_unlock(&en->lock);
+
+		if(en->png)
+			en->len[s] = png_encode(&en->enc[s], en->raw[s], en->width, en->height, en->level);
+		else
+			en->len[s] = jpeg_encode(&en->enc[s], en->raw[s], en->width, en->height, en->level);
+		frame_signature(en->sig + s * SIG_SIDE * SIG_SIDE, en->raw[s], en->width, en->height);
+
+		pthread_mutex_lock(&en->lock);
+		en->state[s] = 3;
+		pthread_cond_broadcast(&en->cond);
+	}
+	pthread_mutex_unlock(&en->lock);
+	return NULL;
+}
+
+/* Write encoded frame w to s_path, and free its slot. Called with en->lock
+ * held, which is let go while writing. */
+void swiper_write_frame(struct encoder *en, int w, char *s_path, char *format)
+{
+	FILE *fp;
+	char path[PATH_LEN+1];
+	double now;
+	int s = w % en->nslot;
+
+	pthread_mutex_unlock(&en->lock);
+	snprintf(path, PATH_LEN, "%s/%04d.%s", s_path, w + 1, format);
+	if((fp = fopen(path, "w")) == NULL)
+		dief("failed to open file, '%s'", path);
+	if(fwrite(en->enc[s], 1, en->len[s], fp) != en->len[s] || fclose(fp))
+		dief("failed to write file, '%s'", path);
+	free(en->enc[s]);
+
+	// ...doubling whenever w reaches a power of 2
+	if(!(w & (w - 1)) && (en->sigs = realloc(en->sigs, (w ? 2 * w : 1) * SIG_SIDE * SIG_SIDE)) == NULL)
+		die("low memory; manage system processes.");
+	memcpy(en->sigs + (size_t) w * SIG_SIDE * SIG_SIDE, en->sig + s * SIG_SIDE * SIG_SIDE, SIG_SIDE * SIG_SIDE);
+
+	now = mono_time() - en->start;
+	en->cur.frame = w + 1;
+	en->cur.bytes += en->len[s];
+	en->cur.fps = (now > 0) ? (w + 1) / now : 0;
+	en->cur.speed = (now > 0) ? (w + 1) * en->spf / now : 0;
+	en->cur.eta = (en->cur.fps > 0 && en->cur.nfr > w + 1) ? (en->cur.nfr - w - 1) / en->cur.fps : 0;
+	if(en->pg != NULL)
+		swiper_post_progress(en->pg, &en->cur);
+	if(en->bar != NULL && now - en->shown >= 0.25)
+	{
+		swiper_draw_progress(&en->cur, en->bar);
+		en->shown = now;
+	}
+
+	pthread_mutex_lock(&en->lock);
+	en->enc[s] = NULL;
+	en->state[s] = 0;
+	pthread_cond_broadcast(&en->cond);
+}
+
+/* If the second half of n frames mirrors the first, judged by their
+ * signatures, return how many leading frames replay them when walked forward
+ * then back, else 0. The last frame may either repeat the first (f0..fm..f0)
+ * or lead back into it (f0..fm..f1); either way the turn isn't shown twice. */
+int swiper_mirror_frames(unsigned char *sigs, int n)
+{
+	int len = SIG_SIDE * SIG_SIDE, k, j, b;
+
+	if(n < MIRROR_MIN)
+		return 0;
+
+	for(int shift = 0; shift < 2; ++shift)
+	{
+		// ...block by block, so a change in a small part of the frame (e.g.
+		// something crossing a still scene) isn't averaged away
+		for(k = shift, j = n - 1; k < j; ++k, --j)
+		{
+			for(b = 0; b < len; ++b)
+				if(abs(sigs[k * len + b] - sigs[j * len + b]) > MIRROR_TOL)
+					break;
+			if(b < len)
+				break;
+		}
+		if(k >= j)
+			return (n + 1 + shift) / 2;
+	}
+	return 0;
+}
+
+/* Mark the wallpaper at s_path to be played forward then back, with BMFN (see
+ * macros), keeping only its first keep frames (and their timing), or all of
+ * them if keep is 0 */
+void swiper_fold_frames(char *s_path, char *format, int keep)
+{
+	FILE *fp;
+	char *filepath, *delays = NULL, line[LINE_LEN+1];
+	size_t len = 0;
+
+	filepath = calloc(PATH_LEN+1, 1);
+
+	// frames are numbered from 0001 without gaps
+	if(keep)
+		for(int i = keep + 1; ; ++i)
+		{
+			snprintf(filepath, PATH_LEN, "%s/%04d.%s", s_path, i, format);
+			if(remove(filepath) == -1)
+				break;
+		}
+
+	snprintf(filepath, PATH_LEN, "%s/%s", s_path, TMFN);
+	if(keep && (fp = fopen(filepath, "r")) != NULL) // ...saved with -V
+	{
+		if((delays = calloc(keep, LINE_LEN+1)) == NULL)
+			die("low memory; manage system processes.");
+		for(int i = 0; i < keep && fgets(line, LINE_LEN, fp) != NULL; ++i)
+			len += snprintf(delays + len, LINE_LEN+1, "%s", line);
+		fclose(fp);
+		if((fp = fopen(filepath, "w")) == NULL)
+			dief("failed to open file, '%s'", filepath);
+		fputs(delays, fp);
+		fclose(fp);
+		free(delays);
+	}
+
+	snprintf(filepath, PATH_LEN, "%s/%s", s_path, BMFN);
+	if((fp = fopen(filepath, "w")) == NULL)
+		dief("failed to open file, '%s'", filepath);
+	fclose(fp);
+
+	free(filepath);
+}
+
+/* Unmounts all mounted filesystems at some mount point, char *mp */
+void rolling_umount(char *mp)
+{
+    struct mntent *me;
+    FILE *ptr;
+
+    ptr = setmntent("/etc/mtab", "r+");
+    while((me = getmntent(ptr)) != NULL)
+    {
+        if(!strcmp(mp, me->mnt_dir))
+            umount(mp);
+    }
+    endmntent(ptr);
+}
+
+/* Mount a fresh tmpfs at mount point, char *mp */
+void mount_tmpfs(char *mp)
+{
+	rolling_umount(mp); // protect against duplicate mounts
+
+	// change mount size by changing size=???, and value of MNT_SZ
+	if(mount("tmpfs", mp, "tmpfs", 0, "size=1G,mode=0777") == -1)
+	{
+		printf("errno: %d\n", errno);
+		dief("failed to mount tmpfs at %s", mp);
+	}
+}
+
+/* Copy files in a directory to another directory without recursion. */
+void copydir(char *dst, char *src)
+{
+    DIR *dir = opendir(src);
+    struct dirent *ent;
+    FILE *sptr, *dptr;
+    char sfile[PATH_LEN+1], dfile[PATH_LEN+1];
+    int c;
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        // frames only; hidden files (e.g. SNFN) are read from src
+        if(*(ent->d_name) != '.' && ent->d_type == DT_REG)
+        {
+            snprintf(sfile, PATH_LEN, "%s/%s", src, ent->d_name);
+            snprintf(dfile, PATH_LEN, "%s/%s", dst, ent->d_name);
+            if((sptr = fopen(sfile, "r")) == NULL)
+				dief("failed to open, '%s'", sfile);
+            if((dptr = fopen(dfile, "w")) == NULL)
+				dief("failed to open, '%s'", dfile);
+            while((c = fgetc(sptr)) != EOF)
+                fputc(c, dptr);
+            fclose(sptr);
+            fclose(dptr);
+        }
+    }
+}
+
+/* Read the page cache full of a directory's first-layer files, so the next
+ * reader (i.e. feh) does not stall on disk. */
+void warmdir(char *dirpath)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char filepath[PATH_LEN+1];
+	int fd;
+
+	if((dir = opendir(dirpath)) == NULL)
+		dief("failed to open directory, '%s'", dirpath);
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(ent->d_type != DT_REG)
+			continue;
+		snprintf(filepath, PATH_LEN, "%s/%s", dirpath, ent->d_name);
+		if((fd = open(filepath, O_RDONLY)) == -1)
+			continue;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+	closedir(dir);
+}
+
+/* Store file names of video frames in an array. */
+char **swiper_retrieve_image_names(int *nfiles, char *dirpath, char *format)
+{
+	DIR *dir;
+	struct dirent *ent;
+	int len;
+	char **files;
+
+	dir = opendir(dirpath);
+	*nfiles = lateral_dir_visfile_count(dirpath);
+	len = (sizeof(int) * 4) + 5;
+
+	// cap frames at 9999 (like %04d), or cause overflow later in function
+	if(*nfiles > 9999) 
+	{
+		swiper_shave_s_path(dirpath, *nfiles, format);
+		*nfiles = 9999;
+	}
+
+	files = (char **) malloc(*nfiles * sizeof(char *));
+	if(files == NULL)
 		return NULL;
 	for(int i = 0; (ent = readdir(dir)) != NULL; ++i)
 	{
@@ -836,12 +2278,13 @@ char **swiper_retrieve_image_names(int *nfiles, char *dirpath, char *format)
 }
 
 /* Read file, MDFN, (see macros) into struct metadata md as defined in main() */
-void swiper_load_metadata(struct metadata *md, short int flags, char *s_path)
+void swiper_load_metadata(struct metadata *md, int flags, char *s_path)
 {
 	FILE *fp;
 	char c;
     int i;
     char *filepath, *line;
+	double start = trace_begin();
 
 	filepath = calloc(PATH_LEN+1, 1);
 	line = calloc(LINE_LEN+1, 1);
@@ -861,9 +2304,10 @@ void swiper_load_metadata(struct metadata *md, short int flags, char *s_path)
     md->width = atoi(strtok(NULL, " "));
     md->height = atoi(strtok(NULL, " "));
     md->duration = atof(strtok(NULL, " "));
-    strncpy(md->format, strtok(NULL, " "), 4);
+    snprintf(md->format, sizeof(md->format), "%s", strtok(NULL, " "));
 
-    fclose(fp);
+    fclose(fp); free(filepath); free(line);
+	trace_end("load", start);
 }
 
 /* Count lateral, visible files in a directory i.e. first-layer, non-hidden 
@@ -903,62 +2347,1576 @@ void swiper_shave_s_path(char *s_path, int n, char *format)
 	}
 }
 
-/* Display image frames at md->a_path in order, on loop to create the 
- * apperance of a live wallpaper. */
-void swiper_execute_wallpaper(char **files, int n, char *a_path, double dfps)
+/* Fill struct frameset *fs with the frames of the wallpaper saved at s_path
+ * and displayed from a_path; decodes them into memory for -x. */
+void swiper_load_frameset(struct frameset *fs, struct metadata *md, struct xdisplay *xd, char *s_path, char *a_path, int flags)
 {
-	clock_t start, end;
-	struct timespec reg, res;
-	long n_delay;
+	FILE *fp;
+	char path[PATH_LEN+1];
+	double speed, start, r, t = 0;
+	long prev = 0, end;
+	int mapped = 0;
 
-	reg.tv_sec = 0;
-	n_delay = (1 / dfps) * pow(10, 9); // convert dfps into nanoseconds delay
+	memset(fs, 0, sizeof(struct frameset));
+	fs->a_path = a_path;
+	fs->fps = frstr2double(md->rfps);
 
-	while(1)
+	// interpolation keeps the source speed, -p sets how often frames are made
+	speed = (flags & F_INTERP) ? 1 : frstr2double(md->pfps) / fs->fps;
+
+	if(flags & F_XLIB)
 	{
-		if(term) break;
-		for(int i = 0; i < n; ++i)
+		fs->width = xd->width;
+		fs->height = xd->height;
+
+		// ffmpeg's interpolated frames depend on -p, so aren't kept
+		start = trace_begin();
+		if(!(flags & F_MCI) && !swiper_map_snapshot(fs, s_path))
 		{
-			reg.tv_nsec = n_delay;
-			start = clock();
-			if(term) break;
-			feh_display_wallpaper(files[i], a_path);
-			end = clock();
+			trace_end("map", start);
+			mapped = 1;
+		}
+	}
 
-			// deduct time spent in if(term) and display_wallpaper() from delay
-			reg.tv_nsec -= (((double) end - start) / CLOCKS_PER_SEC) * pow(10,9);
+	if(!mapped)
+	{
+		start = trace_begin();
+		if((fs->files = swiper_retrieve_image_names(&fs->n, s_path, md->format)) == NULL)
+			die("low memory; manage system processes.");
+		trace_end("names", start);
+	}
+	fs->delays = swiper_load_timing(s_path, fs->n, speed); // NULL unless -V
 
-			if(reg.tv_nsec < 0)
-				continue;
-			nanosleep(&reg, &res);
+	// hold each frame for a whole number of refreshes (for -v), unless the
+	// delays only place saved frames in time for -I. Where each frame ends is
+	// rounded, not how long it lasts, so the loop keeps its length, give or
+	// take frames too short to be held a refresh at all.
+	if(fs->delays != NULL && (r = xd->refresh) > 0 && !(flags & F_INTERP))
+	{
+		for(int i = 0; i < fs->n; ++i)
+		{
+			t += fs->delays[i];
+			if((end = lround(t * r)) <= prev)
+				end = prev + 1;
+			fs->delays[i] = (double) (end - prev) / r;
+			prev = end;
+		}
+		printf("cadence: variable timing held to whole refreshes at %.2lfHz, loop of %.3lfs (source %.3lfs)\n",
+				r, prev / r, t);
+	}
+
+	if(flags & F_XLIB && !mapped)
+	{
+		// frames were quantised by -Q; interpolating by ffmpeg adds colours
+		snprintf(path, PATH_LEN, "%s/%s", s_path, PLFN);
+		if(!(flags & F_MCI) && (fp = fopen(path, "r")) != NULL)
+		{
+			flags |= F_PALETTE;
+			if(fgets(path, PATH_LEN, fp) != NULL && !strcmp(path, "frame"))
+				flags |= F_PALFRAME;
+			fclose(fp);
+		}
+		start = trace_begin();
+		swiper_decode_frames(fs, md, flags);
+		trace_end("decode", start);
+		if(!(flags & (F_MCI|F_SHED)) && fs->px != NULL)
+		{
+			start = trace_begin();
+			swiper_save_snapshot(fs, s_path);
+			trace_end("snapshot", start);
 		}
 	}
+
+	// frames are walked forward then back if asked to, or saved folded (of
+	// as many frames as -I mci made)
+	snprintf(path, PATH_LEN, "%s/%s", s_path, BMFN);
+	fs->loop = ((flags & F_BOOMERANG || access(path, F_OK) == 0) && fs->n > 1) ? 2 * fs->n - 2 : fs->n;
 }
 
-/* Display a single wallpaper at a_path/image */
-void feh_display_wallpaper(char *image, char *a_path)
+/* Decode frames at fs->a_path into BGRA at the size of the root window, using
+ * ffmpeg. For -I mci, ffmpeg also interpolates them to -p, so they take up
+ * pfps / rfps times the memory. Frames saved with -Q are kept as palette
+ * indices, a quarter of the size, unless they turn out to have more than 256
+ * colours. */
+void swiper_decode_frames(struct frameset *fs, struct metadata *md, int flags)
 {
-	int len;
-	char *argv[4];
+	FILE *fp;
+	struct palette *pal = NULL, *bak = NULL;
+	unsigned char *buf = NULL, *ix;
+	char *cmd, *filter, *qa;
+	size_t size, npx;
+	int len, cap, nix = 0;
 
-	len = strlen(a_path) + strlen(image) + 2;
-	argv[0] = "feh";
-    argv[1] = "--bg-scale";
-    argv[2] = calloc(len+1, 1);
-    snprintf(argv[2], len, "%s/%s", a_path, image);
-    argv[3] = NULL;
+	len = PATH_LEN*4 + 256;
+	cmd = calloc(len+1, 1);
+	filter = calloc(LINE_LEN+1, 1);
+	npx = (size_t) fs->width * fs->height;
+	size = npx * 4;
 
-	 // so parent won't zombify child processes
-    signal(SIGCHLD, SIG_IGN);
+	if(flags & F_MCI)
+	{
+		if(fs->delays != NULL)
+			die("motion compensated interpolation requires a wallpaper saved without -V");
+		snprintf(filter, LINE_LEN, ",minterpolate=fps=%s:mi_mode=mci", md->pfps);
+		fs->fps = frstr2double(md->pfps);
+	}
+	cap = (flags & F_MCI) ? ceil(fs->n * fs->fps / frstr2double(md->rfps)) + 1 : fs->n;
 
-    // many times faster than fork()
-    if(!vfork())
-    {
-        execvp(argv[0], argv);
-        exit(EXIT_SUCCESS);
-    }
+	// ...left undecoded while shedding, which goes on to stream them instead
+	if((double) ((flags & F_PALETTE) ? npx : size) * cap > (double) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE))
+	{
+		if(!(flags & F_SHED))
+			die("not enough memory to decode frames; save at a lower -r");
+		free(cmd); free(filter);
+		return;
+	}
 
-    free(argv[2]);
+	// nearest neighbour scaling doesn't make colours that aren't in the palette;
+	// -frames:v counts output frames, of which -I mci makes cap
+	qa = shell_quote(fs->a_path);
+	snprintf(cmd, len, "ffmpeg -v 0 -framerate %s -i %s/%%04d.%s -frames:v %d -vf scale=%d:%d%s%s -f rawvideo -pix_fmt bgra -",
+			md->rfps, qa, md->format, cap, fs->width, fs->height, 
+			(flags & F_PALETTE) ? ":flags=neighbor" : "", filter);
+	free(qa);
+
+	if((fp = popen(cmd, "r")) == NULL)
+		dief("failed to open pipe, '%s'", cmd);
+	if((fs->px = calloc(cap, sizeof(unsigned char *))) == NULL)
+		die("low memory; manage system processes.");
+	if(flags & F_PALETTE)
+	{
+		if((fs->ix = calloc(cap, sizeof(unsigned char *))) == NULL
+				|| (fs->lut = calloc(cap, sizeof(uint32_t *))) == NULL
+				|| (pal = calloc(1, sizeof(struct palette))) == NULL
+				|| (bak = malloc(sizeof(struct palette))) == NULL)
+			die("low memory; manage system processes.");
+	}
+
+	printf("decoding frames...\n");
+	for(len = 0; len < cap; ++len)
+	{
+		if(buf == NULL && (buf = malloc(size)) == NULL)
+			die("low memory; manage system processes.");
+		if(fread(buf, 1, size, fp) != size)
+			break;
+
+		if(flags & F_PALETTE)
+		{
+			if(flags & F_PALFRAME)
+			{
+				pal->n = 0;
+				memset(pal->used, 0, PLHASH);
+			}
+			else
+				memcpy(bak, pal, sizeof(struct palette)); // undo if it overflows
+			if((ix = malloc(npx)) == NULL)
+				die("low memory; manage system processes.");
+
+			if(!palette_index(pal, (uint32_t *) buf, ix, npx))
+			{
+				fs->ix[len] = ix;
+				nix++;
+				if(flags & F_PALFRAME)
+				{
+					if((fs->lut[len] = malloc(sizeof(pal->lut))) == NULL)
+						die("low memory; manage system processes.");
+					memcpy(fs->lut[len], pal->lut, sizeof(pal->lut));
+				}
+				continue; // ...and reuse buf
+			}
+			free(ix);
+			if(!(flags & F_PALFRAME))
+				memcpy(pal, bak, sizeof(struct palette));
+		}
+		fs->px[len] = buf;
+		buf = NULL;
+	}
+	pclose(fp);
+	if(!len || (len < fs->n && !(flags & F_MCI)))
+		dief("failed to decode frames at, '%s'", fs->a_path);
+
+	// the shared palette only grows, so indices from earlier frames still hold
+	if(flags & F_PALETTE && !(flags & F_PALFRAME))
+	{
+		if((fs->shared = malloc(sizeof(pal->lut))) == NULL)
+			die("low memory; manage system processes.");
+		memcpy(fs->shared, pal->lut, sizeof(pal->lut));
+		for(int i = 0; i < len; ++i)
+			if(fs->ix[i] != NULL)
+				fs->lut[i] = fs->shared;
+	}
+	if(nix)
+	{
+		printf("%d of %d frames indexed by palette\n", nix, len);
+		if((fs->out[0] = malloc(size)) == NULL || (fs->out[1] = malloc(size)) == NULL)
+			die("low memory; manage system processes.");
+	}
+
+	// interpolated frames have no names, and are played at their own rate
+	if(flags & F_MCI)
+	{
+		for(int i = 0; i < fs->n; ++i)
+			free(fs->files[i]);
+		free(fs->files);
+		fs->files = NULL;
+		fs->n = len;
+	}
+
+	if(buf != NULL)
+		free(buf);
+	if(pal != NULL)
+	{
+		free(pal); free(bak);
+	}
+	free(cmd); free(filter);
+}
+
+/* Free what swiper_load_frameset() allocated */
+void swiper_free_frameset(struct frameset *fs)
+{
+	if(fs->files != NULL)
+	{
+		for(int i = 0; i < fs->n; ++i)
+			free(fs->files[i]);
+		free(fs->files);
+	}
+	if(fs->delays != NULL)
+		free(fs->delays);
+	if(fs->px != NULL)
+	{
+		for(int i = 0; i < fs->n && fs->map == NULL; ++i)
+			if(fs->px[i] != NULL)
+				free(fs->px[i]);
+		free(fs->px);
+	}
+	if(fs->ix != NULL)
+	{
+		for(int i = 0; i < fs->n && fs->map == NULL; ++i)
+		{
+			if(fs->ix[i] != NULL)
+				free(fs->ix[i]);
+			if(fs->lut[i] != NULL && fs->lut[i] != fs->shared)
+				free(fs->lut[i]);
+		}
+		free(fs->ix); free(fs->lut);
+		if(fs->shared != NULL)
+			free(fs->shared);
+	}
+	if(fs->map != NULL)
+		munmap(fs->map, fs->mapsize);
+	for(int i = 0; i < 2; ++i)
+		if(fs->out[i] != NULL)
+			free(fs->out[i]);
+	if(fs->big != NULL)
+		free(fs->big);
+	if(fs->stream != NULL)
+		pclose(fs->stream);
+	memset(fs, 0, sizeof(struct frameset));
+}
+
+/* Hash the names, sizes and modification times of files at s_path, and the
+ * size frames are decoded at, to tell when SNFN (see macros) is stale. */
+uint64_t swiper_snapshot_hash(char *s_path, int width, int height)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat sb;
+	char filepath[PATH_LEN+1];
+	uint64_t h, sum = 0;
+
+	if((dir = opendir(s_path)) == NULL)
+		dief("failed to open directory, '%s'", s_path);
+
+	// readdir() order isn't stable, so combine per-file hashes by addition
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(ent->d_type != DT_REG || !strncmp(ent->d_name, SNFN, strlen(SNFN)))
+			continue;
+		snprintf(filepath, PATH_LEN, "%s/%s", s_path, ent->d_name);
+		if(stat(filepath, &sb) == -1)
+			continue;
+		h = fnv1a(0, ent->d_name, strlen(ent->d_name));
+		h = fnv1a(h, &sb.st_size, sizeof(sb.st_size));
+		h = fnv1a(h, &sb.st_mtim, sizeof(sb.st_mtim));
+		sum += h;
+	}
+	closedir(dir);
+
+	h = fnv1a(sum, &width, sizeof(int));
+	return fnv1a(h, &height, sizeof(int));
+}
+
+/* Path of SNFN (see macros) at s_path for frames decoded at width x height.
+ * Each size has its own, so monitors of different sizes (for -m) don't keep
+ * replacing one another's. */
+void swiper_snapshot_path(char *path, char *s_path, int width, int height)
+{
+	snprintf(path, PATH_LEN, "%s/%s-%dx%d", s_path, SNFN, width, height);
+}
+
+/* Open SNFN (see macros) at s_path and read its header into hdr, if not NULL.
+ * Returns its file descriptor, or -1 if it's missing or stale. */
+int swiper_open_snapshot(char *s_path, int width, int height, struct snapshot *hdr)
+{
+	struct snapshot tmp;
+	char filepath[PATH_LEN+1];
+	int fd;
+
+	if(hdr == NULL)
+		hdr = &tmp;
+	swiper_snapshot_path(filepath, s_path, width, height);
+	if((fd = open(filepath, O_RDONLY)) == -1)
+		return -1;
+	if(read(fd, hdr, sizeof(struct snapshot)) != sizeof(struct snapshot)
+			|| memcmp(hdr->magic, SNMAGIC, 8) || hdr->width != width || hdr->height != height
+			|| hdr->hash != swiper_snapshot_hash(s_path, width, height))
+	{
+		close(fd);
+		return -1;
+	}
+	if(hdr == &tmp)
+	{
+		close(fd);
+		return 0;
+	}
+	return fd;
+}
+
+/* Point fs at decoded frames mapped from SNFN (see macros) at s_path, so they
+ * are paged in as they are first displayed rather than decoded up front.
+ * Returns -1 if there is no usable snapshot. */
+int swiper_map_snapshot(struct frameset *fs, char *s_path)
+{
+	struct snapshot hdr;
+	struct stat sb;
+	uint64_t *table, head, len;
+	size_t npx = (size_t) fs->width * fs->height;
+	int fd;
+
+	if((fd = swiper_open_snapshot(s_path, fs->width, fs->height, &hdr)) == -1)
+		return -1;
+	fstat(fd, &sb);
+	fs->mapsize = sb.st_size;
+	fs->map = mmap(NULL, fs->mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(fs->map == MAP_FAILED)
+	{
+		fs->map = NULL;
+		return -1;
+	}
+
+	// a snapshot cut short (e.g. by a full disk, before writes were checked)
+	// would have frames past the end of the mapping
+	head = page_align(sizeof(struct snapshot));
+	table = (uint64_t *) (fs->map + head);
+	if(head + (uint64_t) hdr.n * 2 * sizeof(uint64_t) > fs->mapsize)
+		hdr.n = 0;
+	for(int i = 0; i < hdr.n; ++i)
+	{
+		len = table[2*i+1] ? npx : npx * 4;
+		if(table[2*i] > fs->mapsize || len > fs->mapsize - table[2*i] || (table[2*i+1]
+				&& (table[2*i+1] > fs->mapsize || 256 * sizeof(uint32_t) > fs->mapsize - table[2*i+1])))
+			hdr.n = 0;
+	}
+	if(!hdr.n)
+	{
+		munmap(fs->map, fs->mapsize);
+		fs->map = NULL;
+		return -1;
+	}
+
+	fs->n = hdr.n;
+	if((fs->px = calloc(fs->n, sizeof(unsigned char *))) == NULL
+			|| (fs->ix = calloc(fs->n, sizeof(unsigned char *))) == NULL
+			|| (fs->lut = calloc(fs->n, sizeof(uint32_t *))) == NULL)
+		die("low memory; manage system processes.");
+	for(int i = 0; i < fs->n; ++i)
+	{
+		if(table[2*i+1]) // indexed by a palette
+		{
+			fs->ix[i] = fs->map + table[2*i];
+			fs->lut[i] = (uint32_t *) (fs->map + table[2*i+1]);
+		}
+		else
+			fs->px[i] = fs->map + table[2*i];
+	}
+	if((fs->out[0] = malloc((size_t) fs->width * fs->height * 4)) == NULL
+			|| (fs->out[1] = malloc((size_t) fs->width * fs->height * 4)) == NULL)
+		die("low memory; manage system processes.");
+
+	printf("mapped %d decoded frames from %s\n", fs->n, SNFN);
+	return 0;
+}
+
+/* Write the decoded frames of fs to SNFN (see macros) at s_path for the next
+ * start. Written aside and renamed, so a snapshot is either whole or absent. */
+void swiper_save_snapshot(struct frameset *fs, char *s_path)
+{
+	FILE *fp;
+	struct snapshot hdr;
+	uint64_t *table, off;
+	size_t npx, head;
+	char *filepath, *tmppath;
+	int npal = 0, ok;
+
+	filepath = calloc(PATH_LEN+1, 1);
+	tmppath = calloc(PATH_LEN+8, 1);
+	npx = (size_t) fs->width * fs->height;
+
+	memcpy(hdr.magic, SNMAGIC, 8);
+	hdr.width = fs->width;
+	hdr.height = fs->height;
+	hdr.n = fs->n;
+	hdr.hash = swiper_snapshot_hash(s_path, fs->width, fs->height);
+
+	// palettes follow the table: the shared one once, else one per frame
+	for(int i = 0; i < fs->n; ++i)
+		if(fs->ix != NULL && fs->ix[i] != NULL && (fs->lut[i] != fs->shared || !npal))
+			npal++;
+	head = page_align(sizeof(struct snapshot));
+	off = head + page_align(fs->n * 2 * sizeof(uint64_t) + npal * 256 * sizeof(uint32_t));
+
+	if((table = calloc(fs->n * 2, sizeof(uint64_t))) == NULL)
+		die("low memory; manage system processes.");
+	npal = 0;
+	for(int i = 0; i < fs->n; ++i)
+	{
+		table[2*i] = off;
+		if(fs->ix != NULL && fs->ix[i] != NULL)
+		{
+			if(fs->lut[i] != fs->shared || !npal)
+				npal++;
+			table[2*i+1] = head + fs->n * 2 * sizeof(uint64_t) + (npal - 1) * 256 * sizeof(uint32_t);
+			off += page_align(npx);
+		}
+		else
+			off += page_align(npx * 4);
+	}
+
+	swiper_snapshot_path(filepath, s_path, fs->width, fs->height);
+	snprintf(tmppath, PATH_LEN+7, "%s.part", filepath);
+	if((fp = fopen(tmppath, "w")) == NULL) // ...e.g. read-only library
+	{
+		free(table); free(filepath); free(tmppath);
+		return;
+	}
+
+	// any write that falls short (e.g. a full disk) leaves no snapshot at all
+	ok = fwrite(&hdr, sizeof(struct snapshot), 1, fp) == 1
+			&& !fseek(fp, head, SEEK_SET)
+			&& fwrite(table, sizeof(uint64_t), fs->n * 2, fp) == fs->n * 2;
+	npal = 0;
+	for(int i = 0; i < fs->n && ok; ++i)
+		if(fs->ix != NULL && fs->ix[i] != NULL && (fs->lut[i] != fs->shared || !npal++))
+			ok = fwrite(fs->lut[i], sizeof(uint32_t), 256, fp) == 256;
+	for(int i = 0; i < fs->n && ok; ++i)
+	{
+		if(fseek(fp, table[2*i], SEEK_SET)) // holes are left as padding
+			ok = 0;
+		else if(table[2*i+1])
+			ok = fwrite(fs->ix[i], 1, npx, fp) == npx;
+		else
+			ok = fwrite(fs->px[i], 1, npx * 4, fp) == npx * 4;
+	}
+
+	if(!ok || ferror(fp))
+	{
+		fclose(fp);
+		remove(tmppath);
+	}
+	else if(fclose(fp) || rename(tmppath, filepath))
+		remove(tmppath);
+	else
+		swiper_prune_snapshots(s_path);
+
+	free(table); free(filepath); free(tmppath);
+}
+
+/* Remove each SNFN (see macros) at s_path that no longer matches its frames,
+ * e.g. one for a size the display has since left, so they don't pile up.
+ * Those of other sizes still current (e.g. for other monitors, with -m) stay,
+ * as do unfinished ones, which another thread may be writing. */
+void swiper_prune_snapshots(char *s_path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char filepath[PATH_LEN+1];
+	int width, height, end, len = strlen(SNFN);
+
+	if((dir = opendir(s_path)) == NULL)
+		return;
+	while((ent = readdir(dir)) != NULL)
+	{
+		end = 0;
+		if(strncmp(ent->d_name, SNFN, len)
+				|| sscanf(ent->d_name + len, "-%dx%d%n", &width, &height, &end) != 2
+				|| ent->d_name[len + end] != '\0')
+			continue;
+		if(swiper_open_snapshot(s_path, width, height, NULL) == -1)
+		{
+			snprintf(filepath, PATH_LEN, "%s/%s", s_path, ent->d_name);
+			remove(filepath);
+		}
+	}
+	closedir(dir);
+}
+
+/* Display image frames at md->a_path in order, on loop to create the 
+ * apperance of a live wallpaper. Frame i lasts fs->delays[i] seconds, or
+ * 1 / dfps if there is no timing table (i.e. saved without -V). Frames are
+ * walked forward then back instead, for a boomerang (see fs->loop). Returns after
+ * period seconds, at the end of a loop if period is 0, or never if period is
+ * negative. Frames are shed and restored with memory pressure, if sh isn't
+ * NULL (for -M). */
+void swiper_execute_wallpaper(struct frameset *fs, struct xdisplay *xd, double dfps, double period, struct shedder *sh)
+{
+	double start, deadline, delay;
+	int i;
+
+	start = deadline = mono_time();
+
+	while(1)
+	{
+		if(term) break;
+		for(int k = 0; k < fs->loop; ++k)
+		{
+			i = swiper_loop_frame(fs, k);
+			if(period > 0 && mono_time() - start >= period)
+				return;
+			if(term) break;
+			if(sh != NULL && mono_time() >= sh->next)
+				swiper_watch_pressure(fs, xd, sh);
+			swiper_display_frame(fs, xd, swiper_frame_pixels(fs, i, 0), i);
+
+			// absolute deadlines, so time spent displaying isn't added to delay
+			delay = (fs->delays != NULL) ? fs->delays[i] : 1 / dfps;
+			deadline += delay;
+
+			// fell behind by more than a frame; drop the debt instead of rushing
+			if(mono_time() > deadline + delay)
+				deadline = mono_time();
+			mono_sleep_until(deadline);
+		}
+		if(!period) break;
+	}
+}
+
+/* Look at memory pressure, and shed frames a level under high pressure, or
+ * restore them a level once it has been low for RESTORE_HOLD seconds */
+void swiper_watch_pressure(struct frameset *fs, struct xdisplay *xd, struct shedder *sh)
+{
+	char *names[4] = { "resident", "reclaimable", "half resolution", "streamed" };
+	double now, psi, used;
+	int p, from = sh->level;
+
+	now = mono_time();
+	sh->next = now + PRESSURE_PERIOD;
+	if((p = memory_pressure(&psi, &used)) >= 0 || !sh->calm)
+		sh->calm = now;
+
+	if(p > 0 && sh->level < 3)
+	{
+		swiper_set_level(fs, xd, sh, sh->level + 1);
+		sh->shed++;
+		sh->next = now + SHED_HOLD; // ...for psi's average to catch up
+	}
+	else if(p < 0 && sh->level > 0 && now - sh->calm >= RESTORE_HOLD)
+	{
+		swiper_set_level(fs, xd, sh, sh->level - 1);
+		sh->restored++;
+		sh->calm = now; // ...a level at a time
+	}
+	else
+		return;
+
+	printf("memory pressure %s (psi %.1lf%%, cgroup %.0lf%%): frames %s -> %s (shed %d, restored %d)\n",
+			(p > 0) ? "high" : "low", psi, used * 100, names[from], names[sh->level], sh->shed, sh->restored);
+	fflush(stdout);
+}
+
+/* Reload the frames of fs at level of memory use (see struct shedder), or the
+ * next level down if it can't be had (i.e. no SNFN to map, for 1) */
+void swiper_set_level(struct frameset *fs, struct xdisplay *xd, struct shedder *sh, int level)
+{
+	struct xdisplay half = *xd;
+	double start = trace_begin();
+
+	if(level == 1 && fs->map == NULL && swiper_open_snapshot(sh->s_path, xd->width, xd->height, NULL))
+		level = (sh->level < 1) ? 2 : 0;
+
+	if(level >= 2 || sh->level >= 2 || (level == 1 && fs->map == NULL))
+		swiper_free_frameset(fs);
+
+	// frames that don't fit in what's free are left undecoded (see F_SHED), and
+	// the next level down is tried instead; streaming always fits
+	if(level < 2)
+	{
+		if(fs->n == 0) // ...freed above
+			swiper_load_frameset(fs, sh->md, xd, sh->s_path, sh->a_path, sh->flags | F_SHED);
+		if(fs->px == NULL)
+		{
+			swiper_free_frameset(fs);
+			level = 2;
+		}
+		// pages of a private read-only mapping are dropped for the kernel to
+		// read back from SNFN as they're shown, or read back now to restore
+		else if(fs->map != NULL)
+			madvise(fs->map, fs->mapsize, (level == 1) ? MADV_DONTNEED : MADV_WILLNEED);
+	}
+	if(level == 2)
+	{
+		half.width = xd->width / 2;
+		half.height = xd->height / 2;
+		swiper_load_frameset(fs, sh->md, &half, sh->s_path, sh->a_path, sh->flags | F_SHED);
+		if(fs->px == NULL)
+		{
+			swiper_free_frameset(fs);
+			level = 3;
+		}
+		else
+		{
+			fs->dwidth = xd->width;
+			fs->dheight = xd->height;
+			if((fs->big = malloc((size_t) xd->width * xd->height * 4)) == NULL)
+				die("low memory; manage system processes.");
+		}
+	}
+	if(level == 3)
+		swiper_stream_frames(fs, sh->md, xd, sh->s_path, sh->a_path, sh->flags);
+	sh->level = level;
+	trace_end("shed", start);
+}
+
+/* Point fs at frames decoded by ffmpeg one at a time, as they're shown,
+ * instead of held in memory (for -M) */
+void swiper_stream_frames(struct frameset *fs, struct metadata *md, struct xdisplay *xd, char *s_path, char *a_path, int flags)
+{
+	char *cmd, *qa;
+	int len = PATH_LEN*4 + 512;
+
+	swiper_load_frameset(fs, md, xd, s_path, a_path, flags & ~F_XLIB); // ...names and timing only
+	fs->width = xd->width;
+	fs->height = xd->height;
+	fs->next = 0;
+
+	cmd = calloc(len+1, 1);
+	qa = shell_quote(a_path);
+	// image2 only reads forward, so a boomerang's frames are piped in loop order
+	if(fs->loop != fs->n)
+		snprintf(cmd, len, "cd %s && while cat $(seq -f %%04g.%s 1 %d) $(seq -f %%04g.%s %d -1 2); do :; done | "
+				"ffmpeg -v 0 -f image2pipe -c:v %s -i - -vf scale=%d:%d -f rawvideo -pix_fmt bgra -",
+				qa, md->format, fs->n, md->format, fs->n - 1, strcmp(md->format, "png") ? "mjpeg" : "png",
+				fs->width, fs->height);
+	else
+		snprintf(cmd, len, "ffmpeg -v 0 -stream_loop -1 -framerate %s -i %s/%%04d.%s -vf scale=%d:%d -f rawvideo -pix_fmt bgra -",
+				md->rfps, qa, md->format, fs->width, fs->height);
+	if((fs->stream = popen(cmd, "r")) == NULL)
+		dief("failed to open pipe, '%s'", cmd);
+	if((fs->out[0] = malloc((size_t) fs->width * fs->height * 4)) == NULL)
+		die("low memory; manage system processes.");
+	free(cmd); free(qa);
+}
+
+/* Same as swiper_execute_wallpaper(), but display dfps frames per second
+ * regardless of the frame rate they were saved at, crossfading between the two
+ * saved frames either side of each instant (-I blend). */
+void swiper_execute_interpolated(struct frameset *fs, struct xdisplay *xd, double dfps, double period)
+{
+	unsigned char *mix;
+	double *starts, total, t = 0, tm, start, deadline;
+	size_t size;
+	int a = 0, b, w;
+
+	size = (size_t) fs->width * fs->height * 4;
+	if((mix = malloc(size)) == NULL || (starts = malloc((fs->n + 1) * sizeof(double))) == NULL)
+		die("low memory; manage system processes.");
+
+	// when each saved frame starts, in seconds into the loop
+	starts[0] = 0;
+	for(int i = 0; i < fs->n; ++i)
+		starts[i+1] = starts[i] + ((fs->delays != NULL) ? fs->delays[i] : 1 / fs->fps);
+
+	// a boomerang turns as the last frame starts, and blends its way back
+	total = (fs->loop != fs->n) ? 2 * starts[fs->n - 1] : starts[fs->n];
+
+	start = deadline = mono_time();
+	while(!term)
+	{
+		if(period > 0 && mono_time() - start >= period)
+			break;
+
+		// frames are visited in order, either way, so the search is only ever
+		// a step or two
+		tm = (fs->loop != fs->n && t > total / 2) ? total - t : t;
+		while(tm >= starts[a+1])
+			a++;
+		while(tm < starts[a])
+			a--;
+		b = (a + 1) % fs->n;
+		w = 256 * (tm - starts[a]) / (starts[a+1] - starts[a]);
+
+		if(w <= 0 || a == b)
+			swiper_display_frame(fs, xd, swiper_frame_pixels(fs, a, 0), a);
+		else
+		{
+			double bstart = trace_begin();
+
+			blend_frames(mix, swiper_frame_pixels(fs, a, 0), swiper_frame_pixels(fs, b, 1), w, size);
+			trace_end("blend", bstart);
+			swiper_display_frame(fs, xd, mix, a);
+		}
+
+		deadline += 1 / dfps;
+		if(mono_time() > deadline + 1 / dfps)
+			deadline = mono_time();
+		mono_sleep_until(deadline);
+
+		if((t += 1 / dfps) >= total) // end of loop
+		{
+			if(!period) break;
+			t -= total * floor(t / total);
+			a = 0;
+		}
+	}
+	free(mix); free(starts);
+}
+
+/* Quantise fps to the nearest the display can show evenly, i.e. each frame
+ * held for the same whole number of refreshes (for -v), and report both.
+ * Frames of fs timed by its delays instead (for -V, without -I) were held to
+ * refreshes as they were loaded, so fps goes unused and isn't reported. */
+double swiper_cadence(double fps, struct frameset *fs, struct xdisplay *xd, int flags)
+{
+	double k;
+
+	if(xd->refresh <= 0 || (fs->delays != NULL && !(flags & F_INTERP)))
+		return fps;
+	k = fmax(1, round(xd->refresh / fps));
+	printf("cadence: requested %.2lffps, achieved %.2lffps (every %.0lf refresh%s at %.2lfHz)\n",
+			fps, xd->refresh / k, k, (k > 1) ? "es" : "", xd->refresh);
+	return xd->refresh / k;
+}
+
+/* Display at least BENCH_MIN frames back to back and print, as one JSON
+ * object, how long it took to display the first frame since t0, how long
+ * caching took, and what displaying a frame costs. With feh, a frame counts
+ * as displayed once feh has exited, not just been started. */
+void swiper_execute_bench(struct frameset *fs, struct metadata *md, struct xdisplay *xd, double t0, double tcache, int flags)
+{
+	double *costs, start, sum = 0, first = 0, cbytes = 0;
+	int i, n;
+
+	n = (fs->n > BENCH_MIN) ? fs->n : BENCH_MIN;
+	if((costs = malloc(n * sizeof(double))) == NULL)
+		die("low memory; manage system processes.");
+
+	for(i = 0; i < n && !term; ++i)
+	{
+		start = mono_time();
+		if(flags & F_XLIB)
+			swiper_display_frame(fs, xd, swiper_frame_pixels(fs, i % fs->n, 0), i % fs->n);
+		else
+			feh_display_wallpaper(fs->files[i % fs->n], fs->a_path, 1);
+		costs[i] = mono_time() - start;
+		sum += costs[i];
+		if(!i)
+			first = mono_time() - t0;
+	}
+	if(!(n = i)) // interrupted
+	{
+		free(costs);
+		return;
+	}
+	qsort(costs, n, sizeof(double), cmp_double);
+
+	if(flags & F_CACHE && tcache > 0)
+		cbytes = lateral_dir_visfile_size(fs->a_path);
+
+	printf("{\"backend\": \"%s\", \"frames\": %d, \"width\": %d, \"height\": %d, \"format\": \"%s\", "
+			"\"snapshot\": %s, \"startup_s\": %.6lf, \"cache_s\": %.6lf, \"cache_mb_s\": %.2lf, "
+			"\"present_mean_ms\": %.4lf, \"present_p50_ms\": %.4lf, \"present_p99_ms\": %.4lf, "
+			"\"present_max_ms\": %.4lf}\n",
+			(flags & F_XLIB) ? "x" : "feh", fs->n, fs->px ? fs->width : md->width, 
+			fs->px ? fs->height : md->height, md->format, fs->map ? "true" : "false", first, tcache,
+			(tcache > 0) ? cbytes / tcache / 1e6 : 0, sum / n * 1e3, costs[n / 2] * 1e3,
+			costs[(int) (n * 0.99)] * 1e3, costs[n - 1] * 1e3);
+	free(costs);
+}
+
+/* Decoded BGRA pixels of frame i (for -x), expanded into fs->out[slot] first
+ * if it is indexed by a palette (for -Q). NULL if frames are shown by feh. */
+unsigned char *swiper_frame_pixels(struct frameset *fs, int i, int slot)
+{
+	unsigned char *px;
+	size_t size = (size_t) fs->width * fs->height * 4;
+	double start;
+
+	if(fs->stream != NULL) // ...in loop order, so skip to i after a change of level
+	{
+		start = trace_begin();
+		do
+			if(fread(fs->out[slot], 1, size, fs->stream) != size)
+				die("failed to stream frames");
+		while(swiper_loop_frame(fs, fs->next++ % fs->loop) != i);
+		trace_end("stream", start);
+		px = fs->out[slot];
+	}
+	else if(fs->px == NULL)
+		return NULL;
+	else if(fs->ix == NULL || fs->ix[i] == NULL)
+		px = fs->px[i];
+	else
+	{
+		start = trace_begin();
+		palette_expand((uint32_t *) fs->out[slot], fs->ix[i], fs->lut[i], (size_t) fs->width * fs->height);
+		trace_end("expand", start);
+		px = fs->out[slot];
+	}
+
+	// only one frame is shown at a time when frames are smaller (for -M)
+	if(fs->big != NULL)
+	{
+		start = trace_begin();
+		scale_frame((uint32_t *) fs->big, fs->dwidth, fs->dheight, (uint32_t *) px, fs->width, fs->height);
+		trace_end("scale", start);
+		px = fs->big;
+	}
+	return px;
+}
+
+/* Frame shown at step k of a loop of fs, forward then back for a boomerang */
+int swiper_loop_frame(struct frameset *fs, int k)
+{
+	return (k < fs->n) ? k : fs->loop - k;
+}
+
+/* Display frame i of fs, or the decoded pixels px in its place (for -x) */
+void swiper_display_frame(struct frameset *fs, struct xdisplay *xd, unsigned char *px, int i)
+{
+	double start = trace_begin();
+
+	if(px != NULL)
+		x_display_frame(xd, px);
+	else
+		feh_display_wallpaper(fs->files[i], fs->a_path, 0);
+	trace_end("present", start);
+}
+
+/* Split comma separated library entries, char *arg, into struct playlist */
+void swiper_parse_playlist(struct playlist *pl, char *arg)
+{
+	char *tmp, *tok;
+
+	tmp = strdup(arg); // strtok() modifies string
+	for(tok = strtok(tmp, PLSEP); tok != NULL; tok = strtok(NULL, PLSEP))
+	{
+		if((pl->names = realloc(pl->names, (pl->n + 1) * sizeof(char *))) == NULL)
+			die("low memory; manage system processes.");
+		pl->names[pl->n++] = strndup(tok, FILE_LEN);
+	}
+	free(tmp);
+}
+
+/* Print library entries with a summary of their saved metadata */
+void swiper_list_library(char *l_path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct metadata md;
+	char *e_path, *mdpath;
+	struct stat sb;
+
+	if((dir = opendir(l_path)) == NULL)
+		dief("failed to open directory, '%s'", l_path);
+	e_path = calloc(PATH_LEN+1, 1);
+	mdpath = calloc(PATH_LEN+1, 1);
+	md.name = calloc(FILE_LEN+1, 1);
+	md.rfps = calloc(FIELD_LEN+1, 1);
+	md.pfps = calloc(FIELD_LEN+1, 1);
+
+	printf("library at %s:\n", l_path);
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(ent->d_type != DT_DIR || *(ent->d_name) == '.')
+			continue;
+		snprintf(e_path, PATH_LEN, "%s/%s", l_path, ent->d_name);
+		snprintf(mdpath, PATH_LEN, "%s/%s", e_path, MDFN);
+		if(stat(mdpath, &sb) == -1) // not a saved wallpaper
+			continue;
+		swiper_load_metadata(&md, 0, e_path);
+		printf("\t%s: %s, %dx%d, %.2lffps, %d %s frames\n", ent->d_name, md.name, md.width,
+				md.height, frstr2double(md.rfps), lateral_dir_visfile_count(e_path), md.format);
+	}
+	closedir(dir);
+	free(e_path); free(mdpath); free(md.name); free(md.rfps); free(md.pfps);
+}
+
+/* Cache (-c) or read ahead the frames of a playlist entry and load them, so
+ * that switching to it never stalls playback of the current entry. Runs in its
+ * own thread. */
+void *swiper_preload_entry(void *arg)
+{
+	struct preload *pr = arg;
+	char *a_path = (pr->flags & F_CACHE) ? pr->dst : pr->src;
+	double start = trace_begin();
+
+	if(pr->flags & F_CACHE)
+	{
+		if(mkdir(pr->dst, 0700) == -1 && errno != EEXIST)
+			dief("failed to create directory, '%s'", pr->dst);
+		cleardir(pr->dst);
+		copydir(pr->dst, pr->src);
+	}
+
+	swiper_load_metadata(&pr->md, pr->flags, pr->src);
+	swiper_load_frameset(&pr->fs, &pr->md, pr->xd, pr->src, a_path, pr->flags);
+	if(!(pr->flags & F_XLIB)) // feh reads the files itself
+		warmdir(a_path);
+	trace_end("preload", start);
+
+	return NULL;
+}
+
+/* Rotate between playlist entries every pl->period seconds, or at the end of
+ * each loop. The next entry is preloaded while the current one plays. */
+void swiper_execute_playlist(struct playlist *pl, struct metadata *md, struct pathinfo *pi, struct xdisplay *xd, int flags)
+{
+	struct preload pr[2], *now, *next; // (current, next)
+	int i = 0, j, cur = 0;
+	double dfps;
+
+	for(int k = 0; k < 2; ++k)
+	{
+		pr[k].dst = calloc(PATH_LEN+1, 1);
+		pr[k].src = calloc(PATH_LEN+1, 1);
+		pr[k].md.name = calloc(FILE_LEN+1, 1);
+		pr[k].md.rfps = calloc(FIELD_LEN+1, 1);
+		pr[k].md.pfps = calloc(FIELD_LEN+1, 1);
+		strncpy(pr[k].md.pfps, md->pfps, FIELD_LEN); // kept by -p
+		memset(&pr[k].fs, 0, sizeof(struct frameset));
+		pr[k].xd = xd;
+		pr[k].flags = flags;
+		pr[k].state = 0;
+	}
+
+	if(flags & F_CACHE)
+	{
+		mount_tmpfs(TFSMP);
+		printf("caching frames...\n");
+	}
+
+	// first entry is loaded up front, so errors are seen before daemonizing,
+	// which must also happen before any preload thread exists
+	snprintf(pr[0].src, PATH_LEN, "%s/%s", pi->l_path, pl->names[0]);
+	snprintf(pr[0].dst, PATH_LEN, "%s/%s", TFSMP, pl->names[0]);
+	swiper_preload_entry(&pr[0]);
+	pr[0].state = 2;
+	if(flags & F_DAEMONIZE)
+		if(daemon(1, 0))
+			die("failed to daemonize process");
+
+	while(!term)
+	{
+		now = &pr[cur];
+		next = &pr[!cur];
+
+		if(now->state == 1) // was preloaded while the previous entry played
+			pthread_join(now->tid, NULL);
+		now->state = 2;
+
+		// drop the entry played before this one
+		if(next->state == 2)
+		{
+			swiper_free_frameset(&next->fs);
+			if(flags & F_CACHE)
+			{
+				cleardir(next->dst);
+				rmdir(next->dst);
+			}
+			next->state = 0;
+		}
+
+		if((j = (i + 1) % pl->n) != i)
+		{
+			snprintf(next->src, PATH_LEN, "%s/%s", pi->l_path, pl->names[j]);
+			snprintf(next->dst, PATH_LEN, "%s/%s", TFSMP, pl->names[j]);
+			if(pthread_create(&next->tid, NULL, swiper_preload_entry, next))
+				die("failed to start preload thread");
+			next->state = 1;
+		}
+
+		dfps = swiper_cadence(frstr2double(now->md.pfps), &now->fs, xd, flags);
+		printf("applying %s at %.2lffps%s:\n", pl->names[i], dfps, now->fs.delays ? " (variable)" : "");
+		swiper_print_md(&now->md, flags);
+
+		if(flags & F_INTERP && !(flags & F_MCI))
+			swiper_execute_interpolated(&now->fs, xd, dfps, pl->period);
+		else
+			swiper_execute_wallpaper(&now->fs, xd, dfps, pl->period, NULL);
+
+		if(j != i) // ...otherwise replay the only entry
+		{
+			i = j;
+			cur = !cur;
+		}
+	}
+
+	for(int k = 0; k < 2; ++k)
+	{
+		if(pr[k].state == 1)
+			pthread_join(pr[k].tid, NULL);
+		swiper_free_frameset(&pr[k].fs);
+		free(pr[k].dst); free(pr[k].src);
+		free(pr[k].md.name); free(pr[k].md.rfps); free(pr[k].md.pfps);
+	}
+}
+
+/* Play the wallpaper on each monitor independently: decoded at its size, at
+ * the cadence of its refresh rate (for -v), to its own deadlines, into its
+ * own region of the root pixmap, by its own thread. */
+void swiper_execute_monitors(struct metadata *md, struct pathinfo *pi, struct xdisplay *xd, int flags)
+{
+	struct monitor *mons, *m;
+	int n;
+
+	n = x_list_monitors(xd, &mons);
+
+	// loaded one after another, so monitors of the same size share a snapshot
+	for(int i = 0; i < n; ++i)
+	{
+		m = &mons[i];
+		m->flags = flags;
+		if(flags & F_VSYNC)
+			m->xd.refresh = x_refresh_rate(m->name);
+		swiper_load_frameset(&m->fs, md, &m->xd, pi->s_path, pi->a_path, flags);
+		m->dfps = swiper_cadence(frstr2double(md->pfps), &m->fs, &m->xd, flags);
+		printf("applying wallpaper to %s (%dx%d+%d+%d) at %.2lffps%s\n", m->name, m->xd.width,
+				m->xd.height, m->xd.x, m->xd.y, m->dfps, m->fs.delays ? " (variable)" : "");
+	}
+	swiper_print_md(md, flags);
+	if(flags & F_DAEMONIZE)
+		if(daemon(1, 0))
+			die("failed to daemonize process");
+
+	for(int i = 0; i < n; ++i)
+		if(pthread_create(&mons[i].tid, NULL, swiper_play_monitor, &mons[i]))
+			die("failed to start monitor thread");
+	for(int i = 0; i < n; ++i)
+	{
+		pthread_join(mons[i].tid, NULL);
+		swiper_free_frameset(&mons[i].fs);
+		mons[i].xd.img->data = NULL; // ...belonged to the frameset
+		XDestroyImage(mons[i].xd.img);
+	}
+	free(mons);
+}
+
+/* Play one monitor's frames until terminated */
+void *swiper_play_monitor(void *arg)
+{
+	struct monitor *m = arg;
+
+	if(m->flags & F_INTERP && !(m->flags & F_MCI))
+		swiper_execute_interpolated(&m->fs, &m->xd, m->dfps, -1);
+	else
+		swiper_execute_wallpaper(&m->fs, &m->xd, m->dfps, -1, NULL);
+	return NULL;
+}
+
+/* Display a single wallpaper at a_path/image, returning once feh has set it
+ * if reap, else as soon as it's started */
+void feh_display_wallpaper(char *image, char *a_path, int reap)
+{
+	int len;
+	pid_t pid;
+	char *argv[4];
+
+	len = strlen(a_path) + strlen(image) + 2;
+	argv[0] = "feh";
+    argv[1] = "--bg-scale";
+    argv[2] = calloc(len+1, 1);
+    snprintf(argv[2], len, "%s/%s", a_path, image);
+    argv[3] = NULL;
+
+	 // so parent won't zombify child processes, unless it reaps them itself
+    signal(SIGCHLD, reap ? SIG_DFL : SIG_IGN);
+
+    // many times faster than fork()
+    if(!(pid = vfork()))
+    {
+        execvp(argv[0], argv);
+        exit(EXIT_SUCCESS);
+    }
+    if(reap && pid > 0)
+        waitpid(pid, NULL, 0);
+
+    free(argv[2]);
+}
+
+/* Open the default X display and create a root window sized pixmap which
+ * frames are drawn into, and which is set as the root window's background. */
+void x_open_display(struct xdisplay *xd)
+{
+	Visual *vis;
+	Atom xrootpmap, esetroot, type;
+	unsigned char *data;
+	unsigned long nitems, after;
+	int scr, depth, format;
+	Pixmap old = None;
+
+	if((xd->dpy = XOpenDisplay(NULL)) == NULL)
+		die("failed to open X display, for -x");
+	scr = DefaultScreen(xd->dpy);
+	vis = DefaultVisual(xd->dpy, scr);
+	depth = DefaultDepth(xd->dpy, scr);
+	if(depth < 24 || vis->class != TrueColor)
+		die("-x requires a 24-bit true colour display");
+
+	xd->root = RootWindow(xd->dpy, scr);
+	xd->width = DisplayWidth(xd->dpy, scr);
+	xd->height = DisplayHeight(xd->dpy, scr);
+	xd->pm = XCreatePixmap(xd->dpy, xd->root, xd->width, xd->height, depth);
+	xd->gc = XCreateGC(xd->dpy, xd->pm, 0, NULL);
+
+	// frames are decoded as BGRA, i.e. 0xAARRGGBB read least significant first
+	if((xd->img = XCreateImage(xd->dpy, vis, depth, ZPixmap, 0, NULL, xd->width, xd->height, 32, 0)) == NULL)
+		die("failed to create X image");
+	xd->img->byte_order = LSBFirst;
+
+	// free a pixmap kept alive by the previous setter (e.g. feh, or ourselves)
+	xrootpmap = XInternAtom(xd->dpy, "_XROOTPMAP_ID", False);
+	esetroot = XInternAtom(xd->dpy, "ESETROOT_PMAP_ID", False);
+	if(XGetWindowProperty(xd->dpy, xd->root, esetroot, 0, 1, False, XA_PIXMAP, &type, &format,
+				&nitems, &after, &data) == Success && type == XA_PIXMAP && nitems)
+	{
+		old = *((Pixmap *) data);
+		XFree(data);
+	}
+	if(old != None)
+		XKillClient(xd->dpy, old);
+
+	XChangeProperty(xd->dpy, xd->root, xrootpmap, XA_PIXMAP, 32, PropModeReplace, (unsigned char *) &xd->pm, 1);
+	XChangeProperty(xd->dpy, xd->root, esetroot, XA_PIXMAP, 32, PropModeReplace, (unsigned char *) &xd->pm, 1);
+	XSetWindowBackgroundPixmap(xd->dpy, xd->root, xd->pm);
+}
+
+/* Draw decoded BGRA pixels, of the size of xd's region (the root window's,
+ * without -m), as the wallpaper there */
+void x_display_frame(struct xdisplay *xd, unsigned char *px)
+{
+	xd->img->data = (char *) px;
+	XPutImage(xd->dpy, xd->pm, xd->gc, xd->img, 0, 0, xd->x, xd->y, xd->width, xd->height);
+	XClearArea(xd->dpy, xd->root, xd->x, xd->y, xd->width, xd->height, False);
+
+	// wait for the server, or frames queue up faster than they are shown
+	XSync(xd->dpy, False);
+}
+
+/* Close the X display, leaving the last frame as the wallpaper */
+void x_close_display(struct xdisplay *xd)
+{
+	xd->img->data = NULL; // ...belongs to a struct frameset
+	XDestroyImage(xd->img);
+	XFreeGC(xd->dpy, xd->gc);
+	XSetCloseDownMode(xd->dpy, RetainPermanent);
+	XCloseDisplay(xd->dpy);
+	xd->dpy = NULL;
+}
+
+/* Refresh rate, in Hz, of the current mode of output, or of the primary (or
+ * else first) output if NULL, as reported by xrandr; REFRESH_HZ if it can't
+ * tell (e.g. Xvfb) */
+double x_refresh_rate(char *output)
+{
+	FILE *fp;
+	char line[LINE_LEN+1], *tok;
+	double rate = 0;
+	int want = 0, len = (output != NULL) ? strlen(output) : 0;
+
+	if((fp = popen("xrandr --current 2>/dev/null", "r")) != NULL)
+	{
+		while(fgets(line, LINE_LEN, fp) != NULL)
+		{
+			if(strstr(line, " connected") != NULL)
+				want = (output != NULL) ? !strncmp(line, output, len) && line[len] == ' '
+						: (strstr(line, " primary ") != NULL);
+			else if(strchr(line, '*') != NULL && (!rate || want))
+			{
+				// e.g. "   1920x1080     60.00*+  59.94    50.00"
+				for(tok = strtok(line, " \t"); tok != NULL; tok = strtok(NULL, " \t"))
+					if(strchr(tok, '*') != NULL)
+						rate = atof(tok);
+				if(want && rate > 0)
+					break;
+			}
+		}
+		pclose(fp);
+	}
+	if(rate <= 0)
+	{
+		printf("refresh rate unknown, assuming %dHz\n", REFRESH_HZ);
+		rate = REFRESH_HZ;
+	}
+	return rate;
+}
+
+/* Active monitors, as listed by xrandr, into *mons, each with a copy of xd
+ * that draws into its own region of the root pixmap. The whole root window
+ * counts as one if xrandr can't tell (e.g. Xvfb). Returns how many. */
+int x_list_monitors(struct xdisplay *xd, struct monitor **mons)
+{
+	FILE *fp;
+	struct monitor *m;
+	char line[LINE_LEN+1], *name;
+	int n = 0, x, y, w, h, scr;
+
+	*mons = NULL;
+	if((fp = popen("xrandr --listactivemonitors 2>/dev/null", "r")) != NULL)
+	{
+		while(fgets(line, LINE_LEN, fp) != NULL)
+		{
+			// e.g. " 1: +HDMI-1 1920/527x1080/296+2560+0  HDMI-1"
+			if(sscanf(line, " %*d: %*s %d/%*dx%d/%*d+%d+%d", &w, &h, &x, &y) != 4
+					|| w <= 0 || h <= 0 || x < 0 || y < 0 || x + w > xd->width || y + h > xd->height)
+				continue;
+			if((*mons = realloc(*mons, (n + 1) * sizeof(struct monitor))) == NULL)
+				die("low memory; manage system processes.");
+			m = &(*mons)[n++];
+			memset(m, 0, sizeof(struct monitor));
+			line[strcspn(line, "\n")] = '\0';
+			name = strrchr(line, ' ') + 1;
+			strncpy(m->name, name, FIELD_LEN);
+			m->xd = *xd;
+			m->xd.x = x;
+			m->xd.y = y;
+			m->xd.width = w;
+			m->xd.height = h;
+		}
+		pclose(fp);
+	}
+	if(!n)
+	{
+		if((*mons = calloc(1, sizeof(struct monitor))) == NULL)
+			die("low memory; manage system processes.");
+		strncpy((*mons)->name, "root", FIELD_LEN);
+		(*mons)->xd = *xd;
+		n = 1;
+	}
+
+	// each region is drawn from its own image, by its own thread
+	scr = DefaultScreen(xd->dpy);
+	for(int i = 0; i < n; ++i)
+	{
+		m = &(*mons)[i];
+		if((m->xd.img = XCreateImage(xd->dpy, DefaultVisual(xd->dpy, scr), DefaultDepth(xd->dpy, scr),
+						ZPixmap, 0, NULL, m->xd.width, m->xd.height, 32, 0)) == NULL)
+			die("failed to create X image");
+		m->xd.img->byte_order = LSBFirst;
+	}
+	return n;
+}
+
+/* Fill NUNITS (see macros) characters of bar to show frac of work done */
+void progress_bar(char *bar, double frac)
+{
+	// NUNITS is mutable, but if longer than printf line, it won't overwrite progress bar
+	for(int j = 0; j < NUNITS; ++j)
+		bar[j] = (frac >= (double) j / NUNITS) ? '#' : '-';
+}
+
+/* Encode w x h rgb24 pixels as a jpeg of quality 1 to 100, into memory
+ * allocated at *out. Returns its length. */
+size_t jpeg_encode(unsigned char **out, unsigned char *rgb, int w, int h, int quality)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned long len = 0;
+	JSAMPROW row;
+
+	*out = NULL;
+	cinfo.err = jpeg_std_error(&jerr); // ...which exits on error
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, out, &len);
+	cinfo.image_width = w;
+	cinfo.image_height = h;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while(cinfo.next_scanline < h)
+	{
+		row = rgb + (size_t) cinfo.next_scanline * w * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return len;
+}
+
+/* Encode w x h rgb24 pixels as a png of compression 0 to 9, into memory
+ * allocated at *out. Returns its length. */
+size_t png_encode(unsigned char **out, unsigned char *rgb, int w, int h, int level)
+{
+	png_structp png;
+	png_infop info;
+	struct buffer buf = { NULL, 0, 0 };
+
+	if((png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL
+			|| (info = png_create_info_struct(png)) == NULL)
+		die("low memory; manage system processes.");
+	if(setjmp(png_jmpbuf(png)))
+		die("failed to encode png frame");
+
+	png_set_write_fn(png, &buf, png_write_buffer, NULL);
+	png_set_compression_level(png, level);
+	png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for(int y = 0; y < h; ++y)
+		png_write_row(png, rgb + (size_t) y * w * 3);
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+
+	*out = buf.data;
+	return buf.len;
+}
+
+/* libpng's write callback, appending to a struct buffer */
+void png_write_buffer(png_structp png, png_bytep data, png_size_t n)
+{
+	struct buffer *buf = png_get_io_ptr(png);
+
+	if(buf->len + n > buf->cap)
+	{
+		buf->cap = (buf->len + n) * 2;
+		if((buf->data = realloc(buf->data, buf->cap)) == NULL)
+			die("low memory; manage system processes.");
+	}
+	memcpy(buf->data + buf->len, data, n);
+	buf->len += n;
+}
+
+/* Scale src, sw x sh pixels, to dst, dw x dh pixels, by nearest neighbour */
+void scale_frame(uint32_t *dst, int dw, int dh, uint32_t *src, int sw, int sh)
+{
+	uint32_t *row;
+
+	for(int y = 0; y < dh; ++y)
+	{
+		row = src + (size_t) (y * sh / dh) * sw;
+		for(int x = 0; x < dw; ++x)
+			*dst++ = row[x * sw / dw];
+	}
+}
+
+/* Mean luma of each of SIG_SIDE x SIG_SIDE blocks of rgb, w x h rgb24
+ * pixels, into sig: enough to tell frames apart, cheap to compare, and
+ * forgiving of the noise a lossy source adds */
+void frame_signature(unsigned char *sig, unsigned char *rgb, int w, int h)
+{
+	uint32_t sum[SIG_SIDE * SIG_SIDE] = { 0 }, cnt[SIG_SIDE * SIG_SIDE] = { 0 };
+	int row, b;
+
+	for(int y = 0; y < h; ++y)
+	{
+		row = (y * SIG_SIDE / h) * SIG_SIDE;
+		for(int x = 0; x < w; ++x, rgb += 3)
+		{
+			b = row + x * SIG_SIDE / w;
+			sum[b] += (rgb[0] + 2 * rgb[1] + rgb[2]) / 4;
+			cnt[b]++;
+		}
+	}
+	for(b = 0; b < SIG_SIDE * SIG_SIDE; ++b)
+		sig[b] = cnt[b] ? sum[b] / cnt[b] : 0;
+}
+
+/* Memory pressure: the share of the last 10s that some task stalled on
+ * memory (PSI) into *psi, and how much of its memory.max this process's
+ * cgroup uses into *used (0 if unlimited, or not cgroup v2). Returns 1 if
+ * either is high, -1 if both are low, else 0. */
+int memory_pressure(double *psi, double *used)
+{
+	FILE *fp;
+	char line[PATH_LEN+1] = "", path[PATH_LEN+sizeof(CGROUP_ROOT)+16];
+	double max;
+
+	*psi = *used = 0;
+	if((fp = fopen(PSI_PATH, "r")) != NULL) // e.g. "some avg10=1.23 avg60=..."
+	{
+		if(fgets(line, PATH_LEN, fp) != NULL)
+			sscanf(line, "some avg10=%lf", psi);
+		fclose(fp);
+	}
+
+	// cgroup v2's is "0::/user.slice/...", possibly after v1 hierarchies
+	if((fp = fopen(CGROUP_PATH, "r")) != NULL)
+	{
+		while(fgets(line, PATH_LEN, fp) != NULL && strncmp(line, "0::", 3));
+		if(strncmp(line, "0::", 3))
+			*line = '\0';
+		line[strcspn(line, "\n")] = '\0';
+		fclose(fp);
+	}
+	if(*line)
+	{
+		snprintf(path, sizeof(path), "%s%s/memory.max", CGROUP_ROOT, line + 3);
+		if((max = file_number(path)) > 0) // ..."max" if unlimited
+		{
+			snprintf(path, sizeof(path), "%s%s/memory.current", CGROUP_ROOT, line + 3);
+			*used = file_number(path) / max;
+		}
+	}
+
+	if(*psi >= PSI_HIGH || *used >= CG_HIGH)
+		return 1;
+	return (*psi < PSI_LOW && *used < CG_LOW) ? -1 : 0;
+}
+
+/* The number a file at path starts with, or 0 if it doesn't */
+double file_number(char *path)
+{
+	FILE *fp;
+	double num = 0;
+
+	if((fp = fopen(path, "r")) == NULL)
+		return 0;
+	if(fscanf(fp, "%lf", &num) != 1)
+		num = 0;
+	fclose(fp);
+	return num;
+}
+
+/* Crossfade len bytes of a and b into dst, by w/256 of b */
+void blend_frames(unsigned char *dst, unsigned char *a, unsigned char *b, int w, size_t len)
+{
+	unsigned int wa = 256 - w, wb = w;
+
+	for(size_t i = 0; i < len; ++i)
+		dst[i] = (a[i] * wa + b[i] * wb) >> 8;
+}
+
+/* Map n pixels to their index in palette pl, adding colours as they are seen.
+ * Returns -1 once there would be more than 256. */
+int palette_index(struct palette *pl, uint32_t *px, unsigned char *ix, size_t n)
+{
+	uint32_t c, last = 0;
+	unsigned char lastix = 0;
+	unsigned int h;
+
+	for(size_t i = 0; i < n; ++i)
+	{
+		// flat colour comes in runs, which skip the table
+		if((c = px[i]) == last && i)
+		{
+			ix[i] = lastix;
+			continue;
+		}
+		h = ((c * 2654435761u) >> 20) & (PLHASH - 1);
+		while(pl->used[h] && pl->keys[h] != c)
+			h = (h + 1) & (PLHASH - 1);
+		if(!pl->used[h])
+		{
+			if(pl->n == 256)
+				return -1;
+			pl->used[h] = 1;
+			pl->keys[h] = c;
+			pl->vals[h] = pl->n;
+			pl->lut[pl->n++] = c;
+		}
+		ix[i] = lastix = pl->vals[h];
+		last = c;
+	}
+	return 0;
+}
+
+/* Expand n palette indices into 32-bit pixels through lut */
+void palette_expand(uint32_t *dst, unsigned char *ix, uint32_t *lut, size_t n)
+{
+	size_t i = 0;
+
+	// unrolled so that table loads don't wait on each other
+	for(; i + 8 <= n; i += 8)
+	{
+		dst[i] = lut[ix[i]];
+		dst[i+1] = lut[ix[i+1]];
+		dst[i+2] = lut[ix[i+2]];
+		dst[i+3] = lut[ix[i+3]];
+		dst[i+4] = lut[ix[i+4]];
+		dst[i+5] = lut[ix[i+5]];
+		dst[i+6] = lut[ix[i+6]];
+		dst[i+7] = lut[ix[i+7]];
+	}
+	for(; i < n; ++i)
+		dst[i] = lut[ix[i]];
+}
+
+/* FNV-1a hash of len bytes at data, continuing from h (0 to start) */
+uint64_t fnv1a(uint64_t h, void *data, size_t len)
+{
+	unsigned char *p = data;
+
+	if(!h)
+		h = 14695981039346656037ULL;
+	for(size_t i = 0; i < len; ++i)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* Round size up to a whole number of pages */
+size_t page_align(size_t size)
+{
+	size_t pg = sysconf(_SC_PAGESIZE);
+
+	return (size + pg - 1) / pg * pg;
+}
+
+/* Start writing trace events to the file at path, as a JSON array. A trace
+ * cut short by die() lacks the closing ], which trace viewers accept. */
+void trace_open(char *path)
+{
+	if((tr.fp = fopen(path, "w")) == NULL)
+		dief("failed to open file, '%s'", path);
+	tr.t0 = mono_time();
+	tr.n = 0;
+	fprintf(tr.fp, "[\n");
+}
+
+/* Start of a span, or 0 if not tracing */
+double trace_begin()
+{
+	return (tr.fp != NULL) ? mono_time() : 0;
+}
+
+/* Write a complete event, name, for the span since start; timestamps are in
+ * microseconds since trace_open() */
+void trace_end(char *name, double start)
+{
+	double end;
+
+	if(tr.fp == NULL)
+		return;
+	end = mono_time();
+	pthread_mutex_lock(&tr.lock);
+	fprintf(tr.fp, "%s{\"name\": \"%s\", \"cat\": \"swiper\", \"ph\": \"X\", \"ts\": %.1lf, \"dur\": %.1lf, \"pid\": %d, \"tid\": %ld}",
+			tr.n++ ? ",\n" : "", name, (start - tr.t0) * 1e6, (end - start) * 1e6, getpid(), (long) syscall(SYS_gettid));
+	pthread_mutex_unlock(&tr.lock);
+}
+
+/* Finish the trace file, if tracing */
+void trace_close()
+{
+	if(tr.fp == NULL)
+		return;
+	fprintf(tr.fp, "\n]\n");
+	fclose(tr.fp);
+	tr.fp = NULL;
 }
 
 /* Display error message and exit program */